@@ -134,33 +134,26 @@ static const struct hid_device_id hconf_devs[] = {
 	{ HID_TLC(HUP_DIGITIZERS, HUD_CONFIG) },
 };
 
-static int
-hconf_set_feature_control(struct hconf_softc *sc, int ctrl_id, u_int val)
+/*
+ * Build feature report containing the control with value val. Assume the
+ * report is write-only. Then we have to check for other controls that may
+ * share the same report and set their bits as well.
+ */
+static void
+hconf_fill_feature_report(struct hconf_softc *sc, int ctrl_id, u_int val,
+    uint8_t *fbuf)
 {
-	struct feature_control *fc;
-	uint8_t *fbuf;
-	int error;
+	struct feature_control *fc = &sc->feature_controls[ctrl_id];
 	int i;
 
-	KASSERT(ctrl_id >= 0 && ctrl_id < CONTROLS_COUNT,
-	    ("impossible ctrl id %d", ctrl_id));
-	fc = &sc->feature_controls[ctrl_id];
-	if (fc->rlen <= 1)
-		return (ENXIO);
+	sx_assert(&sc->lock, SA_XLOCKED);
 
-	fbuf = malloc(fc->rlen, M_TEMP, M_WAITOK | M_ZERO);
-	sx_xlock(&sc->lock);
-
-	/*
-	 * Assume the report is write-only. Then we have to check for other
-	 * controls that may share the same report and set their bits as well.
-	 */
 	bzero(fbuf + 1, fc->rlen - 1);
 	for (i = 0; i < nitems(sc->feature_controls); i++) {
 		struct feature_control *ofc = &sc->feature_controls[i];
 
 		/* Skip unrelated report IDs. */
-		if (ofc->rid != fc->rid)
+		if (ofc->rid != fc->rid || ofc->rlen <= 1)
 			continue;
 		KASSERT(fc->rlen == ofc->rlen,
 		    ("different lengths for report %d: %d vs %d\n",
@@ -170,7 +163,25 @@ hconf_set_feature_control(struct hconf_softc *sc, int ctrl_id, u_int val)
 	}
 
 	fbuf[0] = fc->rid;
+}
+
+static int
+hconf_set_feature_control(struct hconf_softc *sc, int ctrl_id, u_int val)
+{
+	struct feature_control *fc;
+	uint8_t *fbuf;
+	int error;
 
+	KASSERT(ctrl_id >= 0 && ctrl_id < CONTROLS_COUNT,
+	    ("impossible ctrl id %d", ctrl_id));
+	fc = &sc->feature_controls[ctrl_id];
+	if (fc->rlen <= 1)
+		return (ENXIO);
+
+	fbuf = malloc(fc->rlen, M_TEMP, M_WAITOK | M_ZERO);
+	sx_xlock(&sc->lock);
+
+	hconf_fill_feature_report(sc, ctrl_id, val, fbuf);
 	error = hid_set_report(sc->dev, fbuf, fc->rlen,
 	    HID_FEATURE_REPORT, fc->rid);
 	if (error == 0)
@@ -210,19 +221,19 @@ hconf_feature_control_handler(SYSCTL_HANDLER_ARGS)
 
 
 static int
-hconf_parse_feature(struct feature_control *fc, uint8_t tlc_index,
-    uint16_t usage, void *d_ptr, hid_size_t d_len)
+hconf_parse_feature(device_t dev, struct feature_control *fc,
+    uint8_t tlc_index, uint16_t usage)
 {
 	uint32_t flags;
 
-	if (!hidbus_locate(d_ptr, d_len, HID_USAGE2(HUP_DIGITIZERS, usage),
+	if (!hidbus_locate_item(dev, HID_USAGE2(HUP_DIGITIZERS, usage),
 	    hid_feature, tlc_index, 0, &fc->loc, &flags, &fc->rid, NULL))
 		return (ENOENT);
 
 	if ((flags & (HIO_VARIABLE | HIO_RELATIVE)) != HIO_VARIABLE)
 		return (EINVAL);
 
-	fc->rlen = hid_report_size_1(d_ptr, d_len, hid_feature, fc->rid);
+	fc->rlen = hidbus_report_size(dev, hid_feature, fc->rid);
 	return (0);
 }
 
@@ -246,26 +257,16 @@ hconf_attach(device_t dev)
 	struct hconf_softc *sc = device_get_softc(dev);
 	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(dev);
 	struct sysctl_oid *tree = device_get_sysctl_tree(dev);
-	void *d_ptr;
-	hid_size_t d_len;
 	uint8_t tlc_index;
-	int error;
 	int i;
 
-	error = hid_get_report_descr(dev, &d_ptr, &d_len);
-	if (error) {
-		device_printf(dev, "could not retrieve report descriptor from "
-		    "device: %d\n", error);
-		return (ENXIO);
-	}
-
 	sc->dev = dev;
 	sx_init(&sc->lock, device_get_nameunit(dev));
 
 	tlc_index = hidbus_get_index(dev);
 	for (i = 0; i < nitems(sc->feature_controls); i++) {
-		(void)hconf_parse_feature(&sc->feature_controls[i], tlc_index,
-		    feature_control_descrs[i].usage, d_ptr, d_len);
+		(void)hconf_parse_feature(dev, &sc->feature_controls[i],
+		    tlc_index, feature_control_descrs[i].usage);
 		if (sc->feature_controls[i].rlen > 1) {
 			SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
 			    feature_control_descrs[i].name,
@@ -289,26 +290,54 @@ hconf_detach(device_t dev)
 	return (0);
 }
 
+/*
+ * Restore last applied controls. Each affected report is built once and all
+ * of them are submitted back to back, so transport can send them within
+ * single bus ownership period instead of one synchronous request per control.
+ */
 static int
 hconf_resume(device_t dev)
 {
 	struct hconf_softc *sc = device_get_softc(dev);
-	int error;
-	int i;
+	struct hid_request reqs[CONTROLS_COUNT];
+	struct feature_control *fc;
+	uint8_t *fbuf;
+	int i, j, nreqs = 0;
 
+	sx_xlock(&sc->lock);
 	for (i = 0; i < nitems(sc->feature_controls); i++) {
-		if (sc->feature_controls[i].rlen < 2)
+		fc = &sc->feature_controls[i];
+		if (fc->rlen < 2)
 			continue;
 		/* Do not update usages to default value */
-		if (sc->feature_controls[i].val ==
-		    feature_control_descrs[i].value)
+		if (fc->val == feature_control_descrs[i].value)
 			continue;
-		error = hconf_set_feature_control(sc, i,
-		    sc->feature_controls[i].val);
-		if (error != 0) {
-			DPRINTF("Failed to restore %s: %d\n",
-			    feature_control_descrs[i].name, error);
-		}
+		/* Report shared with already restored control */
+		for (j = 0; j < nreqs; j++)
+			if (reqs[j].id == fc->rid)
+				break;
+		if (j < nreqs)
+			continue;
+		fbuf = malloc(fc->rlen, M_TEMP, M_WAITOK | M_ZERO);
+		hconf_fill_feature_report(sc, i, fc->val, fbuf);
+		reqs[nreqs++] = (struct hid_request) {
+			.data = fbuf,
+			.len = fc->rlen,
+			.type = HID_FEATURE_REPORT,
+			.id = fc->rid,
+			.write = true,
+		};
+	}
+
+	if (nreqs != 0)
+		(void)hidbus_submit_wait(dev, reqs, nreqs);
+	sx_unlock(&sc->lock);
+
+	for (i = 0; i < nreqs; i++) {
+		if (reqs[i].error != 0)
+			DPRINTF("Failed to restore report %u: %d\n",
+			    reqs[i].id, reqs[i].error);
+		free(reqs[i].data, M_TEMP);
 	}
 
 	return (0);
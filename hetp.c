@@ -53,6 +53,7 @@ __FBSDID("$FreeBSD$");
 #include "hid.h"
 #include "hidbus.h"
 #include "hidquirk.h"
+#include "hidmt.h"
 
 #define HID_DEBUG_VAR   hetp_debug
 #include "hid_debug.h"
@@ -117,10 +118,23 @@ SYSCTL_INT(_hw_hid_hetp, OID_AUTO, debug, CTLFLAG_RWTUN,
 #define	HETP_FINGER_MAX_WIDTH	15
 #define	HETP_PRESSURE_BASE	25
 
+/* Layout of decoded contact data fed to hidmt engine */
+enum {
+	HETP_MT_TRACKING_ID,
+	HETP_MT_X,
+	HETP_MT_Y,
+	HETP_MT_PRESSURE,
+	HETP_MT_ORIENTATION,
+	HETP_MT_MAJOR,
+	HETP_MT_MINOR,
+	HETP_MT_N_PROPS,
+};
+
 struct hetp_softc {
 	device_t		dev;
 
 	struct evdev_dev	*evdev;
+	struct hidmt		mt;
 	bool			initialized;
 	uint8_t			report_id;
 	hid_size_t		report_len;
@@ -267,8 +281,6 @@ hetp_attach(struct hetp_softc *sc)
 {
 	const struct hid_device_info *hw = hid_get_device_info(sc->dev);
 	device_t mouse;
-	void *d_ptr;
-	hid_size_t d_len;
 	int32_t minor, major;
 	int error;
 
@@ -280,18 +292,10 @@ hetp_attach(struct hetp_softc *sc)
 	/* Try to detect 3-rd button by relative mouse TLC */
 	mouse = hidbus_find_child(device_get_parent(sc->dev),
 	    HID_USAGE2(HUP_GENERIC_DESKTOP, HUG_MOUSE));
-	if (!sc->is_clickpad && mouse != NULL) {
-		error = hid_get_report_descr(sc->dev, &d_ptr, &d_len);
-		if (error != 0) {
-			device_printf(sc->dev, "could not retrieve report "
-			    "descriptor from device: %d\n", error);
-			return (ENXIO);
-		}
-		if (hidbus_locate(d_ptr, d_len, HID_USAGE2(HUP_BUTTON, 3),
-		    hid_input, hidbus_get_index(mouse), 0, NULL, NULL, NULL,
-		    NULL))
-			sc->has_3buttons = true;
-	}
+	if (!sc->is_clickpad && mouse != NULL &&
+	    hidbus_locate_item(mouse, HID_USAGE2(HUP_BUTTON, 3), hid_input,
+	    hidbus_get_index(mouse), 0, NULL, NULL, NULL, NULL))
+		sc->has_3buttons = true;
 
 	sc->evdev = evdev_alloc();
 	evdev_set_name(sc->evdev, device_get_desc(sc->dev));
@@ -333,6 +337,15 @@ hetp_attach(struct hetp_softc *sc)
 	evdev_support_abs(sc->evdev, ABS_MT_TOUCH_MINOR, 0, 0, minor, 0, 0, 0);
 	evdev_support_abs(sc->evdev, ABS_DISTANCE, 0, 0, 1, 0, 0, 0);
 
+	hidmt_init(&sc->mt, sc->evdev, false);
+	hidmt_add_prop(&sc->mt, HETP_MT_TRACKING_ID, ABS_MT_TRACKING_ID);
+	hidmt_add_prop(&sc->mt, HETP_MT_X, ABS_MT_POSITION_X);
+	hidmt_add_prop(&sc->mt, HETP_MT_Y, ABS_MT_POSITION_Y);
+	hidmt_add_prop(&sc->mt, HETP_MT_PRESSURE, ABS_MT_PRESSURE);
+	hidmt_add_prop(&sc->mt, HETP_MT_ORIENTATION, ABS_MT_ORIENTATION);
+	hidmt_add_prop(&sc->mt, HETP_MT_MAJOR, ABS_MT_TOUCH_MAJOR);
+	hidmt_add_prop(&sc->mt, HETP_MT_MINOR, ABS_MT_TOUCH_MINOR);
+
 	error = evdev_register_mtx(sc->evdev, hidbus_get_lock(sc->dev));
 	if (error != 0) {
 		hetp_detach(sc);
@@ -356,12 +369,13 @@ hetp_detach(struct hetp_softc *sc)
 }
 
 static void
-hetp_intr(void *context, void *buf, hid_size_t len)
+hetp_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
 {
 	struct hetp_softc *sc = context;
 	uint8_t *report, *fdata;
+	uint32_t data[HETP_MT_N_PROPS];
 	int32_t finger;
-	int32_t x, y, p, w, h, wh, ori, min, maj;
+	int32_t x, y, p, w, h, wh;
 
 	/* we seem to get 0 length reports sometimes, ignore them */
 	report = buf;
@@ -390,28 +404,24 @@ hetp_intr(void *context, void *buf, hid_size_t len)
 				continue;
 			}
 
-			y = sc->max_y - y;
 			/* Reduce trace size to not treat large finger as palm */
 			w = (wh & 0x0F) * (sc->trace_x - HETP_FWIDTH_REDUCE);
 			h = (wh >> 4) * (sc->trace_y - HETP_FWIDTH_REDUCE);
-			ori = w > h ? 1 : 0;
-			maj = MAX(w, h);
-			min = MIN(w, h);
-			p = MIN(p + sc->pressure_base, HETP_MAX_PRESSURE);
-
-			evdev_push_abs(sc->evdev, ABS_MT_SLOT, finger);
-			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, finger);
-			evdev_push_abs(sc->evdev, ABS_MT_POSITION_X, x);
-			evdev_push_abs(sc->evdev, ABS_MT_POSITION_Y, y);
-			evdev_push_abs(sc->evdev, ABS_MT_PRESSURE, p);
-			evdev_push_abs(sc->evdev, ABS_MT_ORIENTATION, ori);
-			evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MAJOR, maj);
-			evdev_push_abs(sc->evdev, ABS_MT_TOUCH_MINOR, min);
-		} else {
-			evdev_push_abs(sc->evdev, ABS_MT_SLOT, finger);
-			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, -1);
-		}
+
+			data[HETP_MT_TRACKING_ID] = finger;
+			data[HETP_MT_X] = x;
+			data[HETP_MT_Y] = sc->max_y - y;
+			data[HETP_MT_PRESSURE] =
+			    MIN(p + sc->pressure_base, HETP_MAX_PRESSURE);
+			data[HETP_MT_ORIENTATION] = w > h ? 1 : 0;
+			data[HETP_MT_MAJOR] = MAX(w, h);
+			data[HETP_MT_MINOR] = MIN(w, h);
+
+			hidmt_push_contact(&sc->mt, finger, data);
+		} else
+			hidmt_release_contact(&sc->mt, finger);
 	}
+	hidmt_end_frame(&sc->mt);
 
 	evdev_push_key(sc->evdev, BTN_LEFT,
 	    report[HETP_TOUCH_INFO] & HETP_TOUCH_LMB);
@@ -751,5 +761,6 @@ MODULE_DEPEND(hetp_iic, hidbus, 1, 1, 1);
 MODULE_DEPEND(hetp_iic, hid, 1, 1, 1);
 MODULE_DEPEND(hetp_iic, iicbus, IICBUS_MINVER, IICBUS_PREFVER, IICBUS_MAXVER);
 MODULE_DEPEND(hetp_iic, evdev, 1, 1, 1);
+MODULE_DEPEND(hetp_iic, hidmt, 1, 1, 1);
 MODULE_VERSION(hetp_iic, 1);
 HID_PNP_INFO(hetp_iic_devs);
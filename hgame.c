@@ -51,7 +51,8 @@ __FBSDID("$FreeBSD$");
 #define HGAME_MAP_BRG(number_from, number_to, code)	\
 	{ HIDMAP_KEY_RANGE(HUP_BUTTON, number_from, number_to, code) }
 #define HGAME_MAP_ABS(usage, code)	\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code) }
+	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code), \
+	    .derive_fuzz = true }
 #define HGAME_MAP_GCB(usage, callback)	\
 	{ HIDMAP_ANY_CB(HUP_GENERIC_DESKTOP, HUG_##usage, callback) }
 #define HGAME_MAP_CRG(usage_from, usage_to, callback)	\
@@ -34,6 +34,7 @@
 
 #include <sys/param.h>
 #include <sys/bus.h>
+#include <sys/counter.h>
 #include <sys/kdb.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
@@ -158,6 +159,61 @@ hid_in_polling_mode(void)
 	return (HID_IN_POLLING_MODE_VALUE());
 }
 
+/*
+ * Input report latency histogram. Bucket N counts delays in range of
+ * [2^(N-1), 2^N) microseconds, the last bucket holds everything above.
+ */
+void
+hid_latency_alloc(counter_u64_t *hist)
+{
+	int i;
+
+	for (i = 0; i < HID_LATENCY_NBUCKETS; i++)
+		hist[i] = counter_u64_alloc(M_WAITOK);
+}
+
+void
+hid_latency_free(counter_u64_t *hist)
+{
+	int i;
+
+	for (i = 0; i < HID_LATENCY_NBUCKETS; i++) {
+		counter_u64_free(hist[i]);
+		hist[i] = NULL;
+	}
+}
+
+void
+hid_latency_record(counter_u64_t *hist, sbintime_t delay)
+{
+	uint64_t us;
+
+	us = delay > 0 ? sbttous(delay) : 0;
+	counter_u64_add(hist[MIN(flsll(us), HID_LATENCY_NBUCKETS - 1)], 1);
+}
+
+void
+hid_field_init(struct hid_field *field, const struct hid_location *loc)
+{
+	field->loc = *loc;
+	field->kind = HID_FIELD_GENERIC;
+	field->shift = loc->pos % 8;
+	field->off = loc->pos / 8;
+
+	if (loc->pos / 8 > UINT16_MAX - 4)
+		return;
+	if (loc->size == 1)
+		field->kind = HID_FIELD_BIT;
+	else if (field->shift != 0)
+		return;
+	else if (loc->size == 8)
+		field->kind = HID_FIELD_U8;
+	else if (loc->size == 16)
+		field->kind = HID_FIELD_U16;
+	else if (loc->size == 32)
+		field->kind = HID_FIELD_U32;
+}
+
 int
 hid_get_rdesc(device_t dev, void *data, hid_size_t len)
 {
@@ -191,6 +247,12 @@ hid_set_report(device_t dev, const void *data, hid_size_t len, uint8_t type,
 	return (HID_SET_REPORT(device_get_parent(dev), data, len, type, id));
 }
 
+int
+hid_submit_report(device_t dev, struct hid_request *req)
+{
+	return (HID_SUBMIT_REPORT(device_get_parent(dev), req));
+}
+
 int
 hid_set_idle(device_t dev, uint16_t duration, uint8_t id)
 {
@@ -31,6 +31,8 @@
 #ifndef _HID_H_
 #define	_HID_H_
 
+#include <sys/endian.h>
+
 #include <dev/usb/usb.h>
 #include <dev/usb/usbdi.h>
 #include <dev/usb/usbhid.h>
@@ -118,18 +120,117 @@ struct hid_rdesc_info {
 #define	HID_GET_USAGE(u) ((u) & 0xffff)
 #define	HID_GET_USAGE_PAGE(u) (((u) >> 16) & 0xffff)
 
-typedef void hid_intr_t(void *context, void *data, hid_size_t len);
+/*
+ * Input report handler. time is the sbinuptime() at which the transport
+ * received the report, taken as close to the hardware event as possible.
+ */
+typedef void hid_intr_t(void *context, void *data, hid_size_t len,
+    sbintime_t time);
 typedef bool hid_test_quirk_t(const struct hid_device_info *dev_info,
     uint16_t quirk);
 
+/*
+ * Asynchronous GET_REPORT/SET_REPORT request. Submitter owns the structure
+ * and data buffer until completion callback is called. The callback is
+ * called with the private HID mutex held and must not sleep or submit
+ * new requests. If intr is set, data is an output report sent the same way
+ * as with hid_write(), i.e. over interrupt channel, and type and id are
+ * ignored.
+ */
+struct hid_request;
+typedef void hid_request_cb_t(struct hid_request *req);
+
+struct hid_request {
+	void		*data;
+	hid_size_t	len;		/* Buffer size or report length */
+	hid_size_t	actlen;		/* Length of report got */
+	uint8_t		type;		/* HID_(INPUT|OUTPUT|FEATURE)_REPORT */
+	uint8_t		id;
+	bool		write;		/* SET_REPORT if true */
+	bool		intr;		/* hid_write() if true */
+	int		error;
+	hid_request_cb_t *cb;
+	void		*cb_ctx;
+	STAILQ_ENTRY(hid_request) link;	/* Transport backend private */
+};
+
 static __inline uint32_t
 hid_get_udata(const uint8_t *buf, hid_size_t len, struct hid_location *loc)
 {
 	return (hid_get_data_unsigned(buf, len, loc));
 }
 
+/*
+ * Report field location classified at parse time. Byte aligned 8, 16 and
+ * 32 bit and single bit fields are extracted with plain loads, the rest
+ * falls back to bit-granular hid_get_data().
+ */
+enum hid_field_kind {
+	HID_FIELD_GENERIC,
+	HID_FIELD_BIT,
+	HID_FIELD_U8,
+	HID_FIELD_U16,
+	HID_FIELD_U32,
+};
+
+struct hid_field {
+	struct hid_location	loc;
+	uint8_t			kind;	/* enum hid_field_kind */
+	uint8_t			shift;	/* Bit number for HID_FIELD_BIT */
+	uint16_t		off;	/* Byte offset */
+};
+
+void	hid_field_init(struct hid_field *field, const struct hid_location *loc);
+
+static __inline uint32_t
+hid_field_get_udata(const uint8_t *buf, hid_size_t len,
+    const struct hid_field *f)
+{
+	switch (f->kind) {
+	case HID_FIELD_BIT:
+		return (f->off < len ? (buf[f->off] >> f->shift) & 1 : 0);
+	case HID_FIELD_U8:
+		return (f->off < len ? buf[f->off] : 0);
+	case HID_FIELD_U16:
+		if (f->off + 2 <= len)
+			return (le16dec(buf + f->off));
+		break;
+	case HID_FIELD_U32:
+		if (f->off + 4 <= len)
+			return (le32dec(buf + f->off));
+		break;
+	}
+	return (hid_get_data_unsigned(buf, len, __DECONST(struct hid_location *,
+	    &f->loc)));
+}
+
+static __inline int32_t
+hid_field_get_data(const uint8_t *buf, hid_size_t len,
+    const struct hid_field *f)
+{
+	switch (f->kind) {
+	case HID_FIELD_BIT:
+		return (f->off < len ? -((buf[f->off] >> f->shift) & 1) : 0);
+	case HID_FIELD_U8:
+		return (f->off < len ? (int8_t)buf[f->off] : 0);
+	case HID_FIELD_U16:
+		if (f->off + 2 <= len)
+			return ((int16_t)le16dec(buf + f->off));
+		break;
+	case HID_FIELD_U32:
+		if (f->off + 4 <= len)
+			return ((int32_t)le32dec(buf + f->off));
+		break;
+	}
+	return (hid_get_data(buf, len, __DECONST(struct hid_location *,
+	    &f->loc)));
+}
+
 extern hid_test_quirk_t *hid_test_quirk_p;
 
+/* Number of log2 microsecond buckets in input report latency histogram */
+#define	HID_LATENCY_NBUCKETS	20
+
 /*
  * hid_report_size_1 is a port of userland hid_report_size() from usbhid(3)
  * to kernel. XXX: to be renamed back to hid_report_size()
@@ -141,6 +242,9 @@ int	hid_add_dynamic_quirk(struct hid_device_info *dev_info,
 	    uint16_t quirk);
 void	hidquirk_unload(void *arg);
 int	hid_in_polling_mode(void);
+void	hid_latency_alloc(counter_u64_t *hist);
+void	hid_latency_free(counter_u64_t *hist);
+void	hid_latency_record(counter_u64_t *hist, sbintime_t delay);
 
 int	hid_get_rdesc(device_t, void *, hid_size_t);
 int	hid_read(device_t, void *, hid_size_t, hid_size_t *);
@@ -148,6 +252,7 @@ int	hid_write(device_t, const void *, hid_size_t);
 int	hid_get_report(device_t, void *, hid_size_t, hid_size_t *, uint8_t,
 	    uint8_t);
 int	hid_set_report(device_t, const void *, hid_size_t, uint8_t, uint8_t);
+int	hid_submit_report(device_t, struct hid_request *);
 int	hid_set_idle(device_t, uint16_t, uint8_t);
 int	hid_set_protocol(device_t, uint16_t);
 
@@ -147,6 +147,20 @@ METHOD int set_report {
 	uint8_t id;
 };
 
+#
+# Queue GET_REPORT, SET_REPORT or output report write request and return
+# without waiting for its completion. Requests are executed in order of
+# submission, though output report writes may be reordered with respect to
+# GET/SET_REPORT. Completion callback is called with the private HID mutex
+# held. Returns non-zero and does not call the callback if request can not be
+# queued. Can not be called with the private HID mutex held. In polling mode
+# the request must be executed and the callback called before return.
+#
+METHOD int submit_report {
+	device_t dev;
+	struct hid_request *req;
+};
+
 #
 # Set duration between input reports (in mSec).
 #
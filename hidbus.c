@@ -30,12 +30,18 @@ __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
 #include <sys/bus.h>
+#include <sys/counter.h>
+#include <sys/hash.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/mutex.h>
 #include <sys/queue.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/taskqueue.h>
 
 #include "hid.h"
 #include "hidbus.h"
@@ -52,13 +58,54 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #define	HID_RSIZE_MAX	1024
+#define	HIDBUS_NRIDS	256	/* Number of distinct report IDs */
 
 static hid_intr_t	hidbus_intr;
+static task_fn_t	hidbus_intr_task;
+static task_fn_t	hidbus_output_task;
 
 static device_probe_t	hidbus_probe;
 static device_attach_t	hidbus_attach;
 static device_detach_t	hidbus_detach;
 
+/* Report descriptor index entry */
+struct hidbus_item {
+	int32_t				usage;
+	uint8_t				kind;
+	uint8_t				tlc_index;
+	uint8_t				id;
+	uint32_t			flags;
+	u_int				seq;	/* Descriptor order */
+	struct hid_location		loc;
+	struct hid_absinfo		ai;
+};
+
+/* Output report pool slot */
+struct hidbus_oslot {
+	struct hid_request		req;
+	uint8_t				state;
+#define	HIDBUS_OSLOT_FREE	0
+#define	HIDBUS_OSLOT_TAKEN	1	/* Being filled by driver */
+#define	HIDBUS_OSLOT_STAGED	2	/* Waits for in flight one */
+#define	HIDBUS_OSLOT_BUSY	3	/* Submitted to transport */
+	STAILQ_ENTRY(hidbus_oslot)	link;	/* Staged list */
+};
+
+/* Preallocated output reports of a child, protected by hidbus lock */
+struct hidbus_output {
+	device_t			child;
+	struct mtx			*lock;
+	struct task			task;	/* Submits staged slots */
+	bool				coalesce;
+	bool				intr;	/* Not HQ_NOWRITE */
+	uint8_t				oid;	/* Reports are numbered */
+	int				nslots;
+	int				nbusy;
+	hid_size_t			size;
+	STAILQ_HEAD(, hidbus_oslot)	staged;
+	struct hidbus_oslot		slots[];
+};
+
 struct hidbus_ivars {
 	device_t			child;
 	int32_t				usage;
@@ -67,7 +114,13 @@ struct hidbus_ivars {
 	uintptr_t			driver_info;	/* for internal use */
 	hid_intr_t			*intr_handler;
 	void				*intr_ctx;
+	struct mtx			mtx;	/* Private TLC lock */
+	bool				own_lock; /* mtx is used */
 	bool				open;
+	bool				any_rid; /* Receives all reports */
+	uint8_t				rids[howmany(HIDBUS_NRIDS, NBBY)];
+	counter_u64_t			stat_reports;	/* Dispatched */
+	struct hidbus_output		*output;
 	STAILQ_ENTRY(hidbus_ivars)	link;
 };
 
@@ -75,6 +128,8 @@ struct hidbus_softc {
 	device_t			dev;
 	struct mtx			*lock;
 	struct mtx			mtx;
+	struct task			intr_task;	/* Deferred start/stop */
+	bool				running;	/* Transport started */
 
 	bool				nowrite;
 
@@ -84,8 +139,52 @@ struct hidbus_softc {
 	int				nauto;	/* Number of autochildren */
 
 	STAILQ_HEAD(, hidbus_ivars)	tlcs;
+
+	/* Input report dispatch table indexed by report ID */
+	struct hidbus_ivars		**subs;
+	u_int				*subs_idx;
+
+	/* Report descriptor items sorted by TLC, kind and usage */
+	struct hidbus_item		*items;
+	u_int				nitems;
+
+	/* Statistics */
+	counter_u64_t			stat_reports;
+	counter_u64_t			stat_unclaimed;
+};
+
+/* Precompiled driver device ID table, see HID_PNP_INFO() */
+struct hidbus_id_index {
+	const struct hid_device_id	*table;
+	int				nitems;
+	u_int				mask;	/* Number of buckets - 1 */
+	uint16_t			any;	/* Checked on each lookup */
+	uint16_t			*tlc;	/* Buckets by TLC usage */
+	uint16_t			*vendor; /* Buckets by vendor ID */
+	uint16_t			*next;	/* Bucket chains */
+	uint32_t			*pnp_hash;
+	LIST_ENTRY(hidbus_id_index)	link;
 };
 
+#define	HIDBUS_ID_END		0xffff	/* Bucket chain terminator */
+#define	HIDBUS_ID_NINDEXES	32	/* Registered index hash size */
+
+static LIST_HEAD(, hidbus_id_index) hidbus_id_indexes[HIDBUS_ID_NINDEXES];
+static struct mtx hidbus_id_mtx;
+MTX_SYSINIT(hidbus_id_mtx, &hidbus_id_mtx, "hidbus id index", MTX_DEF);
+
+static __inline u_int
+hidbus_id_hash(uint32_t key, u_int mask)
+{
+	return ((key * 0x9e3779b1u) >> 16 & mask);
+}
+
+static __inline u_int
+hidbus_id_ptr_hash(const void *ptr)
+{
+	return (((uintptr_t)ptr >> 4) % HIDBUS_ID_NINDEXES);
+}
+
 static int
 hidbus_fill_rdesc_info(struct hid_rdesc_info *hri, const void *data,
     hid_size_t len)
@@ -167,6 +266,146 @@ hidbus_locate(const void *desc, hid_size_t size, int32_t u, enum hid_kind k,
 	return (0);
 }
 
+static int
+hidbus_item_cmp(const void *a, const void *b)
+{
+	const struct hidbus_item *ia = a, *ib = b;
+
+	if (ia->tlc_index != ib->tlc_index)
+		return (ia->tlc_index < ib->tlc_index ? -1 : 1);
+	if (ia->kind != ib->kind)
+		return (ia->kind < ib->kind ? -1 : 1);
+	if (ia->usage != ib->usage)
+		return (ia->usage < ib->usage ? -1 : 1);
+	return (ia->seq < ib->seq ? -1 : ia->seq > ib->seq);
+}
+
+/*
+ * Locate HID item in report descriptor index built by hidbus on attach.
+ * Equivalent of hidbus_locate() called for cached report descriptor which
+ * does not require to parse whole descriptor on each call.
+ * Hidbus as well as any hidbus child can be passed as first arg.
+ */
+int
+hidbus_locate_item(device_t dev, int32_t u, enum hid_kind k,
+    uint8_t tlc_index, uint8_t index, struct hid_location *loc,
+    uint32_t *flags, uint8_t *id, struct hid_absinfo *ai)
+{
+	struct hidbus_softc *sc;
+	struct hidbus_item key, *item;
+	device_t bus;
+	u_int lo, hi, mid;
+
+	bus = device_get_devclass(dev) == hidbus_devclass ?
+	    dev : device_get_parent(dev);
+	sc = device_get_softc(bus);
+
+	key = (struct hidbus_item) {
+		.usage = u,
+		.kind = k,
+		.tlc_index = tlc_index,
+		.seq = 0,
+	};
+	lo = 0;
+	hi = sc->nitems;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (hidbus_item_cmp(sc->items + mid, &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	lo += index;
+	item = lo < sc->nitems ? sc->items + lo : NULL;
+	if (item != NULL && item->usage == u && item->kind == k &&
+	    item->tlc_index == tlc_index) {
+		if (loc != NULL)
+			*loc = item->loc;
+		if (flags != NULL)
+			*flags = item->flags;
+		if (id != NULL)
+			*id = item->id;
+		if (ai != NULL && (item->flags & HIO_RELATIVE) == 0)
+			*ai = item->ai;
+		return (1);
+	}
+	if (loc != NULL)
+		loc->size = 0;
+	if (flags != NULL)
+		*flags = 0;
+	if (id != NULL)
+		*id = 0;
+	return (0);
+}
+
+/*
+ * Size of report of given kind and ID in bytes including ID byte as computed
+ * by hid_report_size_1() from the report descriptor index built on attach.
+ * Hidbus as well as any hidbus child can be passed as first arg.
+ */
+hid_size_t
+hidbus_report_size(device_t dev, enum hid_kind k, uint8_t id)
+{
+	struct hidbus_softc *sc;
+	struct hidbus_item *item;
+	device_t bus;
+	uint32_t lpos = UINT32_MAX, hpos = 0, end;
+
+	bus = device_get_devclass(dev) == hidbus_devclass ?
+	    dev : device_get_parent(dev);
+	sc = device_get_softc(bus);
+
+	for (item = sc->items; item < sc->items + sc->nitems; item++) {
+		if (item->kind != k || item->id != id)
+			continue;
+		lpos = MIN(lpos, item->loc.pos);
+		end = item->loc.pos + item->loc.size * item->loc.count;
+		hpos = MAX(hpos, end);
+	}
+	if (lpos > hpos)
+		return (0);
+
+	return ((hpos - lpos + 7) / 8 + (id != 0));
+}
+
+/*
+ * Build input report dispatch table. Reports having given report ID are
+ * delivered only to TLCs which declare that ID in report descriptor.
+ * Children not bound to particular TLC e.g. hidraw receive all reports.
+ */
+static void
+hidbus_update_dispatch(struct hidbus_softc *sc)
+{
+	struct hidbus_ivars *tlc, **subs, **old;
+	u_int *idx;
+	u_int id, n = 0;
+
+	STAILQ_FOREACH(tlc, &sc->tlcs, link)
+		for (id = 0; id < HIDBUS_NRIDS; id++)
+			if (tlc->any_rid || isset(tlc->rids, id))
+				n++;
+
+	subs = malloc(n * sizeof(*subs) + (HIDBUS_NRIDS + 1) * sizeof(*idx),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+	idx = (u_int *)(subs + n);
+	n = 0;
+	for (id = 0; id < HIDBUS_NRIDS; id++) {
+		idx[id] = n;
+		STAILQ_FOREACH(tlc, &sc->tlcs, link)
+			if (tlc->any_rid || isset(tlc->rids, id))
+				subs[n++] = tlc;
+	}
+	idx[HIDBUS_NRIDS] = n;
+
+	mtx_lock(sc->lock);
+	old = sc->subs;
+	sc->subs = subs;
+	sc->subs_idx = idx;
+	mtx_unlock(sc->lock);
+
+	free(old, M_DEVBUF);
+}
+
 static device_t
 hidbus_add_child(device_t dev, u_int order, const char *name, int unit)
 {
@@ -180,10 +419,14 @@ hidbus_add_child(device_t dev, u_int order, const char *name, int unit)
 
 	tlc = malloc(sizeof(struct hidbus_ivars), M_DEVBUF, M_WAITOK | M_ZERO);
 	tlc->child = child;
+	tlc->any_rid = true;
+	tlc->stat_reports = counter_u64_alloc(M_WAITOK);
+	mtx_init(&tlc->mtx, "hidbus tlc lock", NULL, MTX_DEF);
 	device_set_ivars(child, tlc);
 	mtx_lock(sc->lock);
 	STAILQ_INSERT_TAIL(&sc->tlcs, tlc, link);
 	mtx_unlock(sc->lock);
+	hidbus_update_dispatch(sc);
 
 	return (child);
 }
@@ -194,22 +437,76 @@ hidbus_enumerate_children(device_t dev, const void* data, hid_size_t len)
 	struct hidbus_softc *sc = device_get_softc(dev);
 	struct hid_data *hd;
 	struct hid_item hi;
+	struct hidbus_ivars *tlc = NULL;
+	struct hidbus_item *item;
 	device_t child;
+	u_int nitems = 0, nends = 0;
 	uint8_t index = 0;
 
+	free(sc->items, M_DEVBUF);
+	sc->items = NULL;
+	sc->nitems = 0;
+
 	if (data == NULL || len == 0)
 		return (ENXIO);
 
-	/* Add a child for each top level collection */
-	hd = hid_start_parse(data, len, 1 << hid_input);
+	/* Count items to size report descriptor index */
+	hd = hid_start_parse(data, len,
+	    1 << hid_input | 1 << hid_output | 1 << hid_feature);
+	while (hid_get_item(hd, &hi))
+		if (hi.kind == hid_input || hi.kind == hid_output ||
+		    hi.kind == hid_feature)
+			nitems++;
+	hid_end_parse(hd);
+	if (nitems != 0)
+		sc->items = malloc(nitems * sizeof(*sc->items), M_DEVBUF,
+		    M_WAITOK);
+
+	/*
+	 * Add a child for each top level collection and collect input
+	 * report IDs belonging to it to build report dispatch table.
+	 * Fill report descriptor index in the same pass.
+	 */
+	hd = hid_start_parse(data, len,
+	    1 << hid_input | 1 << hid_output | 1 << hid_feature);
 	while (hid_get_item(hd, &hi)) {
+		if ((hi.kind == hid_input || hi.kind == hid_output ||
+		    hi.kind == hid_feature) && sc->nitems < nitems) {
+			item = sc->items + sc->nitems;
+			*item = (struct hidbus_item) {
+				.usage = hi.usage,
+				.kind = hi.kind,
+				/*
+				 * Match HIDBUS_FOREACH_ITEM() numbering which
+				 * counts ends of top level collections.
+				 */
+				.tlc_index = nends,
+				.id = hi.report_ID,
+				.flags = hi.flags,
+				.seq = sc->nitems,
+				.loc = hi.loc,
+				.ai = {
+					.max = hi.logical_maximum,
+					.min = hi.logical_minimum,
+					.res = hid_item_resolution(&hi),
+				},
+			};
+			sc->nitems++;
+		}
+		if (hi.kind == hid_input && tlc != NULL)
+			setbit(tlc->rids, hi.report_ID);
+		if (hi.kind == hid_endcollection && hi.collevel == 0)
+			nends++;
 		if (hi.kind != hid_collection || hi.collevel != 1)
 			continue;
 		child = BUS_ADD_CHILD(dev, 0, NULL, -1);
 		if (child == NULL) {
 			device_printf(dev, "Could not add HID device\n");
+			tlc = NULL;
 			continue;
 		}
+		tlc = device_get_ivars(child);
+		tlc->any_rid = false;
 		hidbus_set_index(child, index);
 		hidbus_set_usage(child, hi.usage);
 		hidbus_set_flags(child, HIDBUS_FLAG_AUTOCHILD);
@@ -219,10 +516,13 @@ hidbus_enumerate_children(device_t dev, const void* data, hid_size_t len)
 	}
 	hid_end_parse(hd);
 
+	qsort(sc->items, sc->nitems, sizeof(*sc->items), hidbus_item_cmp);
+
 	if (index == 0)
 		return (ENXIO);
 
 	sc->nauto = index;
+	hidbus_update_dispatch(sc);
 
 	return (0);
 }
@@ -273,6 +573,7 @@ hidbus_attach_children(device_t dev)
 static int
 hidbus_detach_children(device_t dev)
 {
+	struct hidbus_softc *sc;
 	device_t *children, bus;
 	bool is_bus;
 	int i, error;
@@ -313,7 +614,11 @@ hidbus_detach_children(device_t dev)
 		free(children, M_TEMP);
 	}
 
+	/* Apply pending start/stop requests of TLCs with private locks */
+	sc = device_get_softc(bus);
+	taskqueue_drain(taskqueue_thread, &sc->intr_task);
 	HID_INTR_UNSETUP(device_get_parent(bus));
+	sc->running = false;
 
 	return (error);
 }
@@ -328,6 +633,59 @@ hidbus_probe(device_t dev)
 	return (BUS_PROBE_GENERIC);
 }
 
+static int
+hidbus_sysctl_dispatched(SYSCTL_HANDLER_ARGS)
+{
+	struct hidbus_softc *sc = arg1;
+	struct hidbus_ivars *tlc;
+	struct sbuf sb;
+	int error;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	/* Children list is not populated until transport is set up */
+	if (sc->lock != NULL) {
+		mtx_lock(sc->lock);
+		STAILQ_FOREACH(tlc, &sc->tlcs, link)
+			sbuf_printf(&sb, "%s%s: %ju",
+			    tlc == STAILQ_FIRST(&sc->tlcs) ? "" : "\n",
+			    device_get_nameunit(tlc->child),
+			    (uintmax_t)counter_u64_fetch(tlc->stat_reports));
+		mtx_unlock(sc->lock);
+	}
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	return (error);
+}
+
+static void
+hidbus_stats_init(struct hidbus_softc *sc)
+{
+	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(sc->dev);
+	struct sysctl_oid *tree;
+
+	sc->stat_reports = counter_u64_alloc(M_WAITOK);
+	sc->stat_unclaimed = counter_u64_alloc(M_WAITOK);
+
+	tree = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "stats", CTLFLAG_RD, NULL, "statistics");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "reports", CTLFLAG_RD, &sc->stat_reports,
+	    "number of input reports received from transport");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "unclaimed", CTLFLAG_RD, &sc->stat_unclaimed,
+	    "number of input reports not delivered to any child");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "dispatched", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+	    hidbus_sysctl_dispatched, "A",
+	    "number of input reports dispatched to each child");
+}
+
 static int
 hidbus_attach(device_t dev)
 {
@@ -340,6 +698,8 @@ hidbus_attach(device_t dev)
 	sc->dev = dev;
 	STAILQ_INIT(&sc->tlcs);
 	mtx_init(&sc->mtx, "hidbus lock", NULL, MTX_DEF);
+	TASK_INIT(&sc->intr_task, 0, hidbus_intr_task, sc);
+	hidbus_stats_init(sc);
 
 	/*
 	 * Ignore error. It is possible to emulate HID device on top of
@@ -377,10 +737,34 @@ hidbus_detach(device_t dev)
 	hidbus_detach_children(dev);
 	mtx_destroy(&sc->mtx);
 	free(sc->rdesc.data, M_DEVBUF);
+	free(sc->subs, M_DEVBUF);
+	free(sc->items, M_DEVBUF);
+	counter_u64_free(sc->stat_reports);
+	counter_u64_free(sc->stat_unclaimed);
 
 	return (0);
 }
 
+/* Wait for all submitted and staged output reports to complete */
+static void
+hidbus_output_free(struct hidbus_output *out)
+{
+
+	mtx_lock(out->lock);
+	while (out->nbusy != 0 || !STAILQ_EMPTY(&out->staged)) {
+		if (out->nbusy != 0) {
+			mtx_sleep(out, out->lock, 0, "hidodrn", 0);
+			continue;
+		}
+		mtx_unlock(out->lock);
+		taskqueue_drain(taskqueue_thread, &out->task);
+		mtx_lock(out->lock);
+	}
+	mtx_unlock(out->lock);
+	taskqueue_drain(taskqueue_thread, &out->task);
+	free(out, M_DEVBUF);
+}
+
 static void
 hidbus_child_deleted(device_t bus, device_t child)
 {
@@ -392,6 +776,11 @@ hidbus_child_deleted(device_t bus, device_t child)
 	mtx_lock(sc->lock);
 	STAILQ_REMOVE(&sc->tlcs, tlc, hidbus_ivars, link);
 	mtx_unlock(sc->lock);
+	hidbus_update_dispatch(sc);
+	if (tlc->output != NULL)
+		hidbus_output_free(tlc->output);
+	counter_u64_free(tlc->stat_reports);
+	mtx_destroy(&tlc->mtx);
 	free(tlc, M_DEVBUF);
 }
 
@@ -479,6 +868,331 @@ hidbus_get_lock(device_t child)
 	return (sc->lock);
 }
 
+/*
+ * Switch child to private per-TLC lock and return it. The lock protects
+ * child's state from its interrupt handler, which is called with both the
+ * hidbus lock and the TLC lock held, in that order. Holders of the TLC lock
+ * may call hidbus_intr_start()/hidbus_intr_stop() but must not call into
+ * transport, e.g. issue GET/SET_REPORT requests or writes.
+ */
+struct mtx *
+hidbus_get_tlc_lock(device_t child)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+
+	tlc->own_lock = true;
+
+	return (&tlc->mtx);
+}
+
+static void
+hidbus_submit_wait_cb(struct hid_request *req)
+{
+	int *pending = req->cb_ctx;
+
+	if (--(*pending) == 0)
+		wakeup(pending);
+}
+
+/*
+ * Submit several GET_REPORT/SET_REPORT requests back to back and sleep until
+ * all of them are completed. Per-request status is returned in req->error,
+ * the first non-zero one is returned as well.
+ */
+int
+hidbus_submit_wait(device_t child, struct hid_request *reqs, int nreqs)
+{
+	struct mtx *mtx = hidbus_get_lock(child);
+	int error, i, pending;
+
+	if (HID_IN_POLLING_MODE_FUNC())
+		mtx = NULL;
+
+	pending = nreqs;
+	for (i = 0; i < nreqs; i++) {
+		reqs[i].cb = hidbus_submit_wait_cb;
+		reqs[i].cb_ctx = &pending;
+		reqs[i].actlen = 0;
+		error = hid_submit_report(child, reqs + i);
+		if (error != 0) {
+			reqs[i].error = error;
+			if (mtx != NULL)
+				mtx_lock(mtx);
+			pending--;
+			if (mtx != NULL)
+				mtx_unlock(mtx);
+		}
+	}
+
+	if (mtx != NULL) {
+		mtx_lock(mtx);
+		while (pending != 0)
+			mtx_sleep(&pending, mtx, 0, "hidreq", 0);
+		mtx_unlock(mtx);
+	}
+	/* Transports complete requests in place in polling mode */
+	KASSERT(pending == 0, ("%d requests pending after submit", pending));
+
+	for (i = 0; i < nreqs; i++)
+		if (reqs[i].error != 0)
+			return (reqs[i].error);
+
+	return (0);
+}
+
+/*
+ * Allocate pool of nslots output report buffers for the child. Reports are
+ * written asynchronously with hidbus_output_get() and hidbus_output_submit().
+ * With coalesce set only one report per report ID is in flight at a time
+ * and, while it is, newer reports with the same ID overwrite each other, so
+ * only the latest state is sent. Can not be used in polling mode.
+ */
+int
+hidbus_output_init(device_t child, int nslots, bool coalesce)
+{
+	device_t bus = device_get_parent(child);
+	struct hidbus_softc *sc = device_get_softc(bus);
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+	struct hidbus_output *out;
+	uint8_t *buf;
+	int i;
+
+	if (tlc->output != NULL)
+		return (EBUSY);
+	if (sc->rdesc.osize == 0 || nslots <= 0)
+		return (EINVAL);
+
+	out = malloc(sizeof(*out) + nslots * (sizeof(struct hidbus_oslot) +
+	    sc->rdesc.osize), M_DEVBUF, M_WAITOK | M_ZERO);
+	out->child = child;
+	out->lock = sc->lock;
+	TASK_INIT(&out->task, 0, hidbus_output_task, out);
+	out->coalesce = coalesce;
+	out->intr = !sc->nowrite;
+	out->oid = sc->rdesc.oid;
+	out->nslots = nslots;
+	out->size = sc->rdesc.osize;
+	STAILQ_INIT(&out->staged);
+	buf = (uint8_t *)(out->slots + nslots);
+	for (i = 0; i < nslots; i++)
+		out->slots[i].req.data = buf + i * out->size;
+	tlc->output = out;
+
+	return (0);
+}
+
+static struct hidbus_oslot *
+hidbus_output_find(struct hidbus_output *out, uint8_t state, int id)
+{
+	int i;
+
+	for (i = 0; i < out->nslots; i++)
+		if (out->slots[i].state == state &&
+		    (id < 0 || out->slots[i].req.id == id))
+			return (out->slots + i);
+
+	return (NULL);
+}
+
+/*
+ * Map buffer pointer passed by the driver back to the pool slot. Returns
+ * NULL if the buffer does not belong to the pool or is not taken.
+ */
+static struct hidbus_oslot *
+hidbus_output_slot(struct hidbus_output *out, void *buf)
+{
+	struct hidbus_oslot *slot;
+	uint8_t *base = (uint8_t *)(out->slots + out->nslots);
+	size_t off;
+
+	if ((uint8_t *)buf < base)
+		return (NULL);
+	off = (uint8_t *)buf - base;
+	if (off % out->size != 0 || off / out->size >= (size_t)out->nslots)
+		return (NULL);
+	slot = out->slots + off / out->size;
+	if (slot->state != HIDBUS_OSLOT_TAKEN)
+		return (NULL);
+
+	return (slot);
+}
+
+static void
+hidbus_output_done(struct hid_request *req)
+{
+	struct hidbus_output *out = req->cb_ctx;
+	struct hidbus_oslot *slot = __containerof(req, struct hidbus_oslot, req);
+
+	mtx_assert(out->lock, MA_OWNED);
+
+	if (req->error != 0)
+		DPRINTF("output report %u error %d\n", req->id, req->error);
+	slot->state = HIDBUS_OSLOT_FREE;
+	out->nbusy--;
+	/* Submit report which has been held back by this one */
+	if (!STAILQ_EMPTY(&out->staged))
+		taskqueue_enqueue(taskqueue_thread, &out->task);
+	wakeup(out);
+}
+
+/* Hand slot over to transport. Drops hidbus lock for the time of the call */
+static int
+hidbus_output_start(struct hidbus_output *out, struct hidbus_oslot *slot)
+{
+	int error;
+
+	mtx_assert(out->lock, MA_OWNED);
+
+	slot->state = HIDBUS_OSLOT_BUSY;
+	out->nbusy++;
+	mtx_unlock(out->lock);
+	error = hid_submit_report(out->child, &slot->req);
+	mtx_lock(out->lock);
+	if (error != 0) {
+		slot->req.error = error;
+		hidbus_output_done(&slot->req);
+	}
+
+	return (error);
+}
+
+static void
+hidbus_output_task(void *context, int pending)
+{
+	struct hidbus_output *out = context;
+	struct hidbus_oslot *slot;
+
+	mtx_lock(out->lock);
+	STAILQ_FOREACH(slot, &out->staged, link)
+		if (hidbus_output_find(out, HIDBUS_OSLOT_BUSY,
+		    slot->req.id) == NULL)
+			break;
+	while (slot != NULL) {
+		STAILQ_REMOVE(&out->staged, slot, hidbus_oslot, link);
+		(void)hidbus_output_start(out, slot);
+		STAILQ_FOREACH(slot, &out->staged, link)
+			if (hidbus_output_find(out, HIDBUS_OSLOT_BUSY,
+			    slot->req.id) == NULL)
+				break;
+	}
+	mtx_unlock(out->lock);
+}
+
+/*
+ * Take a free output report buffer large enough for len bytes. Sleeps
+ * until one is freed unless M_NOWAIT is passed in flags. Returns ENOBUFS
+ * if the child has no pool or len exceeds the pool buffer size.
+ */
+int
+hidbus_output_get(device_t child, hid_size_t len, void **buf, int flags)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+	struct hidbus_output *out = tlc->output;
+	struct hidbus_oslot *slot;
+	int error = 0;
+
+	if (out == NULL || len > out->size)
+		return (ENOBUFS);
+
+	mtx_lock(out->lock);
+	while ((slot = hidbus_output_find(out, HIDBUS_OSLOT_FREE, -1)) ==
+	    NULL) {
+		if ((flags & M_NOWAIT) != 0) {
+			error = EWOULDBLOCK;
+			break;
+		}
+		error = mtx_sleep(out, out->lock, PCATCH, "hidoget", 0);
+		if (error != 0)
+			break;
+	}
+	if (slot != NULL)
+		slot->state = HIDBUS_OSLOT_TAKEN;
+	mtx_unlock(out->lock);
+
+	if (slot != NULL)
+		*buf = slot->req.data;
+
+	return (slot != NULL ? 0 : error);
+}
+
+/* Return buffer taken with hidbus_output_get() without sending it */
+void
+hidbus_output_release(device_t child, void *buf)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+	struct hidbus_output *out = tlc->output;
+
+	struct hidbus_oslot *slot;
+
+	mtx_lock(out->lock);
+	slot = hidbus_output_slot(out, buf);
+	if (slot != NULL) {
+		slot->state = HIDBUS_OSLOT_FREE;
+		wakeup(out);
+	} else
+		DPRINTF("release of foreign output buffer %p\n", buf);
+	mtx_unlock(out->lock);
+}
+
+/*
+ * Send report of len bytes filled in to buffer taken with hidbus_output_get()
+ * and return without waiting for completion. The buffer is returned to the
+ * pool when the report is sent. Errors are reported only if the report
+ * could not be queued: EINVAL if the buffer was not taken from the pool and
+ * EMSGSIZE if len exceeds the pool buffer size. In the latter case the
+ * buffer is returned to the pool as well.
+ */
+int
+hidbus_output_submit(device_t child, void *buf, hid_size_t len)
+{
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+	struct hidbus_output *out = tlc->output;
+	struct hidbus_oslot *slot, *prev;
+	int error = 0;
+
+	mtx_lock(out->lock);
+	slot = hidbus_output_slot(out, buf);
+	if (slot == NULL) {
+		mtx_unlock(out->lock);
+		return (EINVAL);
+	}
+	if (len > out->size) {
+		slot->state = HIDBUS_OSLOT_FREE;
+		wakeup(out);
+		mtx_unlock(out->lock);
+		return (EMSGSIZE);
+	}
+	/* try to extract the ID byte */
+	slot->req = (struct hid_request) {
+		.data = buf,
+		.len = len,
+		.type = HID_OUTPUT_REPORT,
+		.id = (out->oid & (len > 0)) ? *(uint8_t *)buf : 0,
+		.write = true,
+		.intr = out->intr,
+		.cb = hidbus_output_done,
+		.cb_ctx = out,
+	};
+
+	if (out->coalesce &&
+	    (prev = hidbus_output_find(out, HIDBUS_OSLOT_STAGED,
+	    slot->req.id)) != NULL) {
+		/* Newer state supersedes one which has not been sent yet */
+		memcpy(prev->req.data, buf, len);
+		prev->req.len = len;
+		slot->state = HIDBUS_OSLOT_FREE;
+		wakeup(out);
+	} else if (out->coalesce &&
+	    hidbus_output_find(out, HIDBUS_OSLOT_BUSY, slot->req.id) != NULL) {
+		slot->state = HIDBUS_OSLOT_STAGED;
+		STAILQ_INSERT_TAIL(&out->staged, slot, link);
+	} else
+		error = hidbus_output_start(out, slot);
+	mtx_unlock(out->lock);
+
+	return (error);
+}
+
 void
 hidbus_set_desc(device_t child, const char *suffix)
 {
@@ -522,24 +1236,44 @@ hidbus_find_child(device_t bus, int32_t usage)
 }
 
 void
-hidbus_intr(void *context, void *buf, hid_size_t len)
+hidbus_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
 {
 	struct hidbus_softc *sc = context;
 	struct hidbus_ivars *tlc;
+	u_int i;
+	uint8_t id;
+
+	bool claimed = false;
 
 	mtx_assert(sc->lock, MA_OWNED);
 
-	/*
-	 * Broadcast input report to all subscribers.
-	 * TODO: Add check for input report ID.
-	 */
-	 STAILQ_FOREACH(tlc, &sc->tlcs, link) {
+	counter_u64_add(sc->stat_reports, 1);
+
+	if (sc->subs == NULL)
+		goto done;
+
+	/* Deliver input report to subscribers of its report ID only. */
+	id = sc->rdesc.iid != 0 && len > 0 ? *(uint8_t *)buf : 0;
+	for (i = sc->subs_idx[id]; i < sc->subs_idx[id + 1]; i++) {
+		tlc = sc->subs[i];
+		if (!tlc->open)
+			continue;
+		if (tlc->own_lock)
+			HID_MTX_LOCK(&tlc->mtx);
+		/* Recheck as private lock holders change it asynchronously */
 		if (tlc->open) {
 			KASSERT(tlc->intr_handler != NULL,
 			    ("hidbus: interrupt handler is NULL"));
-			tlc->intr_handler(tlc->intr_ctx, buf, len);
+			tlc->intr_handler(tlc->intr_ctx, buf, len, time);
+			counter_u64_add(tlc->stat_reports, 1);
+			claimed = true;
 		}
+		if (tlc->own_lock)
+			HID_MTX_UNLOCK(&tlc->mtx);
 	}
+done:
+	if (!claimed)
+		counter_u64_add(sc->stat_unclaimed, 1);
 }
 
 void
@@ -551,48 +1285,77 @@ hidbus_set_intr(device_t child, hid_intr_t *handler, void *context)
 	tlc->intr_ctx = context;
 }
 
-int
-hidbus_intr_start(device_t child)
+/* Start or stop transport according to children state */
+static int
+hidbus_intr_update(struct hidbus_softc *sc)
 {
-	device_t bus = device_get_parent(child);
-	struct hidbus_softc *sc = device_get_softc(bus);
+	device_t transport = device_get_parent(sc->dev);
 	struct hidbus_ivars *tlc;
 	bool open = false;
+	int error = 0;
 
 	mtx_assert(sc->lock, MA_OWNED);
 
-	STAILQ_FOREACH(tlc, &sc->tlcs, link) {
+	STAILQ_FOREACH(tlc, &sc->tlcs, link)
 		open = open || tlc->open;
-		if (tlc->child == child)
-			tlc->open = true;
+
+	if (open && !sc->running) {
+		error = HID_INTR_START(transport);
+		sc->running = error == 0;
+	} else if (!open && sc->running) {
+		error = HID_INTR_STOP(transport);
+		sc->running = false;
 	}
 
-	if (open)
-		return (0);
+	return (error);
+}
+
+/*
+ * Children with private TLC locks can not take hidbus lock to start or
+ * stop transport as it would reverse lock order. Do it on their behalf.
+ */
+static void
+hidbus_intr_task(void *context, int pending)
+{
+	struct hidbus_softc *sc = context;
 
-	return (HID_INTR_START(device_get_parent(bus)));
+	mtx_lock(sc->lock);
+	(void)hidbus_intr_update(sc);
+	mtx_unlock(sc->lock);
 }
 
-int
-hidbus_intr_stop(device_t child)
+static int
+hidbus_intr_set_open(device_t child, bool open)
 {
 	device_t bus = device_get_parent(child);
 	struct hidbus_softc *sc = device_get_softc(bus);
-	struct hidbus_ivars *tlc;
-	bool open = false;
+	struct hidbus_ivars *tlc = device_get_ivars(child);
+
+	if (tlc->own_lock) {
+		HID_MTX_ASSERT(&tlc->mtx, MA_OWNED);
+		tlc->open = open;
+		taskqueue_enqueue(taskqueue_thread, &sc->intr_task);
+		return (0);
+	}
 
 	mtx_assert(sc->lock, MA_OWNED);
+	tlc->open = open;
 
-	STAILQ_FOREACH(tlc, &sc->tlcs, link) {
-		if (tlc->child == child)
-			tlc->open = false;
-		open = open || tlc->open;
-	}
+	return (hidbus_intr_update(sc));
+}
 
-	if (open)
-		return (0);
+int
+hidbus_intr_start(device_t child)
+{
 
-	return (HID_INTR_STOP(device_get_parent(bus)));
+	return (hidbus_intr_set_open(child, true));
+}
+
+int
+hidbus_intr_stop(device_t child)
+{
+
+	return (hidbus_intr_set_open(child, false));
 }
 
 void
@@ -719,6 +1482,182 @@ hidbus_write(device_t dev, const void *data, hid_size_t len)
 	return (hid_write(dev, data, len));
 }
 
+/*------------------------------------------------------------------------*
+ *	hidbus_match_id
+ *
+ * This function checks a single "struct hid_device_id" entry against
+ * the information in "struct hid_device_info" and, for children, against
+ * the top level collection usage.
+ *
+ * Return values:
+ * false: No match.
+ * true: Entry matches.
+ *------------------------------------------------------------------------*/
+static bool
+hidbus_match_id(const struct hid_device_id *id,
+    const struct hid_device_info *info, bool is_child, int32_t usage)
+{
+	if (is_child && (id->match_flag_page) &&
+	    (id->page != HID_GET_USAGE_PAGE(usage))) {
+		return (false);
+	}
+	if (is_child && (id->match_flag_usage) &&
+	    (id->usage != HID_GET_USAGE(usage))) {
+		return (false);
+	}
+	if ((id->match_flag_bus) &&
+	    (id->idBus != info->idBus)) {
+		return (false);
+	}
+	if ((id->match_flag_vendor) &&
+	    (id->idVendor != info->idVendor)) {
+		return (false);
+	}
+	if ((id->match_flag_product) &&
+	    (id->idProduct != info->idProduct)) {
+		return (false);
+	}
+	if ((id->match_flag_ver_lo) &&
+	    (id->idVersion_lo > info->idVersion)) {
+		return (false);
+	}
+	if ((id->match_flag_ver_hi) &&
+	    (id->idVersion_hi < info->idVersion)) {
+		return (false);
+	}
+	if ((id->match_flag_pnp) &&
+	    strncmp(id->idPnP, info->idPnP, HID_PNP_ID_SIZE) != 0) {
+		return (false);
+	}
+
+	return (true);
+}
+
+static const struct hid_device_id *
+hidbus_lookup_id_index(const struct hidbus_id_index *idx,
+    const struct hid_device_info *info, int32_t usage)
+{
+	const struct hid_device_id *id;
+	uint16_t heads[3], best, x;
+	uint32_t pnp_hash = 0;
+	bool pnp_hashed = false;
+	u_int i;
+
+	heads[0] = idx->tlc[hidbus_id_hash(usage, idx->mask)];
+	heads[1] = idx->vendor[hidbus_id_hash(info->idVendor, idx->mask)];
+	heads[2] = idx->any;
+
+	/* Chains are sorted, so the first match in each chain is the best */
+	best = HIDBUS_ID_END;
+	for (i = 0; i < nitems(heads); i++) {
+		for (x = heads[i]; x < best; x = idx->next[x]) {
+			id = idx->table + x;
+			if (id->match_flag_pnp) {
+				if (!pnp_hashed) {
+					pnp_hash = hash32_strn(info->idPnP,
+					    HID_PNP_ID_SIZE, HASHINIT);
+					pnp_hashed = true;
+				}
+				if (idx->pnp_hash[x] != pnp_hash)
+					continue;
+			}
+			if (hidbus_match_id(id, info, true, usage)) {
+				best = x;
+				break;
+			}
+		}
+	}
+
+	return (best == HIDBUS_ID_END ? NULL : idx->table + best);
+}
+
+static struct hidbus_id_index *
+hidbus_id_index_find(const struct hid_device_id *table)
+{
+	struct hidbus_id_index *idx;
+
+	mtx_lock(&hidbus_id_mtx);
+	LIST_FOREACH(idx, &hidbus_id_indexes[hidbus_id_ptr_hash(table)], link)
+		if (idx->table == table)
+			break;
+	mtx_unlock(&hidbus_id_mtx);
+
+	return (idx);
+}
+
+/*
+ * Build device ID table index bucketing entries by TLC usage, else by
+ * vendor ID, else putting them to the list checked on every lookup.
+ * Each bucket chain is sorted by position in the table to preserve
+ * first-match semantics of linear scan.
+ */
+void
+hidbus_id_index_register(const void *arg)
+{
+	const struct hid_device_id_table *idt = arg;
+	const struct hid_device_id *id;
+	struct hidbus_id_index *idx;
+	uint16_t *head;
+	u_int nbuckets;
+	int x;
+
+	if (idt->nitems == 0 || idt->nitems >= HIDBUS_ID_END)
+		return;
+
+	for (nbuckets = 1; nbuckets < idt->nitems; nbuckets <<= 1)
+		;
+	idx = malloc(sizeof(*idx) + idt->nitems * sizeof(uint32_t) +
+	    (2 * nbuckets + idt->nitems) * sizeof(uint16_t), M_DEVBUF,
+	    M_WAITOK | M_ZERO);
+	idx->table = idt->table;
+	idx->nitems = idt->nitems;
+	idx->mask = nbuckets - 1;
+	idx->pnp_hash = (uint32_t *)(idx + 1);
+	idx->tlc = (uint16_t *)(idx->pnp_hash + idt->nitems);
+	idx->vendor = idx->tlc + nbuckets;
+	idx->next = idx->vendor + nbuckets;
+
+	memset(idx->tlc, 0xff, 2 * nbuckets * sizeof(uint16_t));
+	idx->any = HIDBUS_ID_END;
+	for (x = idt->nitems - 1; x >= 0; x--) {
+		id = idt->table + x;
+		if (id->match_flag_page && id->match_flag_usage)
+			head = idx->tlc + hidbus_id_hash(
+			    HID_USAGE2(id->page, id->usage), idx->mask);
+		else if (id->match_flag_vendor)
+			head = idx->vendor +
+			    hidbus_id_hash(id->idVendor, idx->mask);
+		else
+			head = &idx->any;
+		idx->next[x] = *head;
+		*head = x;
+		if (id->match_flag_pnp)
+			idx->pnp_hash[x] = hash32_strn(id->idPnP,
+			    HID_PNP_ID_SIZE, HASHINIT);
+	}
+
+	mtx_lock(&hidbus_id_mtx);
+	LIST_INSERT_HEAD(&hidbus_id_indexes[hidbus_id_ptr_hash(idt->table)],
+	    idx, link);
+	mtx_unlock(&hidbus_id_mtx);
+}
+
+void
+hidbus_id_index_unregister(const void *arg)
+{
+	const struct hid_device_id_table *idt = arg;
+	struct hidbus_id_index *idx;
+
+	idx = hidbus_id_index_find(idt->table);
+	if (idx == NULL)
+		return;
+
+	mtx_lock(&hidbus_id_mtx);
+	LIST_REMOVE(idx, link);
+	mtx_unlock(&hidbus_id_mtx);
+	free(idx, M_DEVBUF);
+}
+
 /*------------------------------------------------------------------------*
  *	hidbus_lookup_id
  *
@@ -734,7 +1673,8 @@ hidbus_lookup_id(device_t dev, const struct hid_device_id *id, int nitems_id)
 {
 	const struct hid_device_id *id_end;
 	const struct hid_device_info *info;
-	int32_t usage;
+	struct hidbus_id_index *idx;
+	int32_t usage = 0;
 	bool is_child;
 
 	if (id == NULL) {
@@ -744,49 +1684,23 @@ hidbus_lookup_id(device_t dev, const struct hid_device_id *id, int nitems_id)
 	id_end = id + nitems_id;
 	info = hid_get_device_info(dev);
 	is_child = device_get_devclass(dev) != hidbus_devclass;
-	if (is_child)
+	if (is_child) {
 		usage = hidbus_get_usage(dev);
+		/* Use precompiled index if driver has registered one */
+		idx = hidbus_id_index_find(id);
+		if (idx != NULL && idx->nitems == nitems_id)
+			return (hidbus_lookup_id_index(idx, info, usage));
+	}
 
 	/*
 	 * Keep on matching array entries until we find a match or
 	 * until we reach the end of the matching array:
 	 */
 	for (; id != id_end; id++) {
-
-		if (is_child && (id->match_flag_page) &&
-		    (id->page != HID_GET_USAGE_PAGE(usage))) {
-			continue;
-		}
-		if (is_child && (id->match_flag_usage) &&
-		    (id->usage != HID_GET_USAGE(usage))) {
-			continue;
-		}
-		if ((id->match_flag_bus) &&
-		    (id->idBus != info->idBus)) {
-			continue;
-		}
-		if ((id->match_flag_vendor) &&
-		    (id->idVendor != info->idVendor)) {
-			continue;
-		}
-		if ((id->match_flag_product) &&
-		    (id->idProduct != info->idProduct)) {
-			continue;
-		}
-		if ((id->match_flag_ver_lo) &&
-		    (id->idVersion_lo > info->idVersion)) {
-			continue;
-		}
-		if ((id->match_flag_ver_hi) &&
-		    (id->idVersion_hi < info->idVersion)) {
-			continue;
-		}
-		if ((id->match_flag_pnp) &&
-		    strncmp(id->idPnP, info->idPnP, HID_PNP_ID_SIZE) != 0) {
-			continue;
+		if (hidbus_match_id(id, info, is_child, usage)) {
+			/* We found a match! */
+			return (id);
 		}
-		/* We found a match! */
-		return (id);
 	}
 
 done:
@@ -847,6 +1761,7 @@ static device_method_t hidbus_methods[] = {
 	DEVMETHOD(hid_write,		hidbus_write),
 	DEVMETHOD(hid_get_report,	hid_get_report),
 	DEVMETHOD(hid_set_report,	hid_set_report),
+	DEVMETHOD(hid_submit_report,	hid_submit_report),
 	DEVMETHOD(hid_set_idle,		hid_set_idle),
 	DEVMETHOD(hid_set_protocol,	hid_set_protocol),
 
@@ -863,3 +1778,4 @@ driver_t hidbus_driver = {
 MODULE_VERSION(hidbus, 1);
 DRIVER_MODULE(hidbus, usbhid, hidbus_driver, hidbus_devclass, 0, 0);
 DRIVER_MODULE(hidbus, iichid, hidbus_driver, hidbus_devclass, 0, 0);
+DRIVER_MODULE(hidbus, vhid, hidbus_driver, hidbus_devclass, 0, 0);
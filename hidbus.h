@@ -94,8 +94,24 @@ struct hid_device_id {
 #define	HID_STD_PNP_INFO					\
   "M16:mask;U16:page;U16:usage;U8:bus;U16:vendor;U16:product;"	\
   "L16:version;G16:version;Z:_HID"
-#define HID_PNP_INFO(table)			\
-  MODULE_PNP_INFO(HID_STD_PNP_INFO, hidbus, table, table, nitems(table))
+
+/*
+ * Besides of PNP info export, HID_PNP_INFO() registers device ID table in
+ * hidbus at module load time to build an index used by hidbus_lookup_id().
+ */
+struct hid_device_id_table {
+	const struct hid_device_id	*table;
+	int				nitems;
+};
+
+#define HID_PNP_INFO(table)						\
+  MODULE_PNP_INFO(HID_STD_PNP_INFO, hidbus, table, table, nitems(table));	\
+  static const struct hid_device_id_table table##_idt =			\
+    { table, nitems(table) };						\
+  C_SYSINIT(table##_idx, SI_SUB_DRIVERS, SI_ORDER_FIRST,		\
+    hidbus_id_index_register, &table##_idt);				\
+  C_SYSUNINIT(table##_idx, SI_SUB_DRIVERS, SI_ORDER_FIRST,		\
+    hidbus_id_index_unregister, &table##_idt)
 
 #define HID_TLC(pg,usg)				\
   .match_flag_page = 1, .match_flag_usage = 1, .page = (pg), .usage = (usg)
@@ -174,13 +190,25 @@ int	hidbus_locate(const void *desc, hid_size_t size, int32_t u,
 	    enum hid_kind k, uint8_t tlc_index, uint8_t index,
 	    struct hid_location *loc, uint32_t *flags, uint8_t *id,
 	    struct hid_absinfo *ai);
+int	hidbus_locate_item(device_t dev, int32_t u, enum hid_kind k,
+	    uint8_t tlc_index, uint8_t index, struct hid_location *loc,
+	    uint32_t *flags, uint8_t *id, struct hid_absinfo *ai);
+hid_size_t	hidbus_report_size(device_t dev, enum hid_kind k, uint8_t id);
 
 const struct hid_device_id *hidbus_lookup_id(device_t,
 		    const struct hid_device_id *, int);
+void		hidbus_id_index_register(const void *);
+void		hidbus_id_index_unregister(const void *);
 struct hid_rdesc_info *hidbus_get_rdesc_info(device_t);
 int		hidbus_lookup_driver_info(device_t,
 		    const struct hid_device_id *, int);
 struct mtx *	hidbus_get_lock(device_t);
+struct mtx *	hidbus_get_tlc_lock(device_t);
+int		hidbus_submit_wait(device_t, struct hid_request *, int);
+int		hidbus_output_init(device_t, int, bool);
+int		hidbus_output_get(device_t, hid_size_t, void **, int);
+void		hidbus_output_release(device_t, void *);
+int		hidbus_output_submit(device_t, void *, hid_size_t);
 void		hidbus_set_intr(device_t, hid_intr_t*, void *);
 int		hidbus_intr_start(device_t);
 int		hidbus_intr_stop(device_t);
@@ -66,6 +66,12 @@ __FBSDID("$FreeBSD$");
 /* HID report descriptor parser limit hardcoded in usbhid.h */
 #define	MAXUSAGE	64
 
+/* Largest array range item with precomputed index to key code map */
+#define	HIDMAP_MAX_CODES	512
+
+/* Minimal fuzz derived from logical range to absorb +-1 LSB noise */
+#define	HIDMAP_FUZZ_MIN	2
+
 static evdev_open_t hidmap_ev_open;
 static evdev_close_t hidmap_ev_close;
 
@@ -189,17 +195,127 @@ hidmap_sync_keys(struct hidmap *hm)
 	bzero(hm->key_rel, howmany(KEY_CNT, 8));
 }
 
+static void
+hidmap_sync(struct hidmap *hm, sbintime_t time)
+{
+
+	if (HIDMAP_WANT_MERGE_KEYS(hm))
+		hidmap_sync_keys(hm);
+	/* Only frames carrying changes get timestamp not to wake up */
+	if (hm->do_timestamps)
+		evdev_push_msc(hm->evdev, MSC_TIMESTAMP,
+		    (int32_t)sbttous(time));
+	evdev_sync(hm->evdev);
+}
+
+/* Push relative motion accumulated since last flush */
+static void
+hidmap_flush_rel(struct hidmap *hm)
+{
+	u_int code;
+
+	while (hm->rel_pending != 0) {
+		code = ffs(hm->rel_pending) - 1;
+		hm->rel_pending &= ~(1u << code);
+		if (hm->rel_accum[code] != 0)
+			evdev_push_rel(hm->evdev, code, hm->rel_accum[code]);
+		hm->rel_accum[code] = 0;
+	}
+}
+
+static void
+hidmap_rel_timeout(void *arg)
+{
+	struct hidmap *hm = arg;
+
+	mtx_assert(hidbus_get_lock(hm->dev), MA_OWNED);
+
+	if (hm->rel_pending == 0)
+		return;
+	hidmap_flush_rel(hm);
+	hidmap_sync(hm, hm->rel_time);
+}
+
+/*
+ * Accumulate relative motion instead of reporting it at every input report.
+ * Accumulated deltas are flushed when coalescing interval expires or with
+ * next frame carrying other changes, e.g. button state.
+ */
+static void
+hidmap_coalesce_rel(struct hidmap *hm, uint16_t code, int32_t data)
+{
+
+	if (hm->rel_pending == 0)
+		callout_reset_sbt(&hm->rel_callout, hm->rel_coalesce, 0,
+		    hidmap_rel_timeout, hm, 0);
+	hm->rel_pending |= 1u << code;
+	hm->rel_accum[code] += data;
+	hm->rel_time = hm->intr_time;
+}
+
+void
+hidmap_set_rel_coalesce(struct hidmap *hm, sbintime_t interval)
+{
+
+	mtx_lock(hidbus_get_lock(hm->dev));
+	hm->rel_coalesce = interval;
+	if (interval == 0 && hm->rel_pending != 0) {
+		callout_stop(&hm->rel_callout);
+		hidmap_rel_timeout(hm);
+	}
+	mtx_unlock(hidbus_get_lock(hm->dev));
+}
+
+/*
+ * Suppress sub-threshold changes of absolute axis. Values within deadzone
+ * around the center snap to it. Changes smaller than fuzz are dropped
+ * unless axis hits its limit. Returns true if value should be ignored.
+ */
+static inline bool
+hidmap_filter_abs(struct hidmap_hid_item *hi, int32_t *data)
+{
+	int64_t center, delta;
+
+	if (hi->deadzone != 0) {
+		center = ((int64_t)hi->lmin + hi->lmax) / 2;
+		delta = *data - center;
+		if (delta >= -hi->deadzone && delta <= hi->deadzone)
+			*data = center;
+	}
+
+	if (hi->fuzz != 0 && *data != hi->lmin && *data != hi->lmax) {
+		delta = (int64_t)*data - hi->last_val;
+		if (delta > -hi->fuzz && delta < hi->fuzz)
+			return (true);
+	}
+
+	return (false);
+}
+
+/* Find key code mapped to HID usage of array item */
+static uint16_t
+hidmap_lookup_key(struct hidmap *hm, int32_t usage)
+{
+	const struct hidmap_item *mi;
+	uint16_t uoff;
+
+	HIDMAP_FOREACH_ITEM(hm, mi, uoff)
+		if (usage == mi->usage + uoff &&
+		    mi->type == EV_KEY && !mi->has_cb)
+			return (mi->code + uoff);
+
+	return (KEY_RESERVED);
+}
+
 void
-hidmap_intr(void *context, void *buf, hid_size_t len)
+hidmap_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
 {
 	struct hidmap *hm = context;
 	struct hidmap_hid_item *hi;
-	const struct hidmap_item *mi;
-	int32_t usage;
 	int32_t data;
-	uint16_t key, uoff;
+	uint16_t key;
 	uint8_t id = 0;
-	bool found, do_sync = false;
+	bool do_sync = false;
 
 	mtx_assert(hidbus_get_lock(hm->dev), MA_OWNED);
 
@@ -215,36 +331,20 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 
 	hm->intr_buf = buf;
 	hm->intr_len = len;
+	hm->intr_time = time;
 
-	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
-		/* At first run callbacks that not tied to HID items */
-		if (hi->type == HIDMAP_TYPE_FINALCB) {
-			DPRINTFN(hm, 6, "type=%d item=%*D\n", hi->type,
-			    (int)sizeof(hi->cb), &hi->cb, " ");
-			if (hi->cb(hm, hi, (union hidmap_cb_ctx){.rid = id})
-			    == 0)
-				do_sync = true;
-			continue;
-		}
-
-		/* Ignore irrelevant reports */
-		if (id != hi->id)
-			continue;
-
-		/*
-		 * 5.8. If Logical Minimum and Logical Maximum are both
-		 * positive values then the contents of a field can be assumed
-		 * to be an unsigned value. Otherwise, all integer values are
-		 * signed values represented in 2’s complement format.
-		 */
-		data = hi->lmin < 0 || hi->lmax < 0
-		    ? hid_get_data(buf, len, &hi->loc)
-		    : hid_get_udata(buf, len, &hi->loc);
+	/* Process only HID items belonging to received report */
+	for (hi = hm->hid_items + hm->rid_idx[id];
+	     hi < hm->hid_items + hm->rid_idx[id + 1];
+	     hi++) {
+		data = hi->is_signed
+		    ? hid_field_get_data(buf, len, &hi->field)
+		    : hid_field_get_udata(buf, len, &hi->field);
 
 		DPRINTFN(hm, 6, "type=%d data=%d item=%*D\n", hi->type, data,
 		    (int)sizeof(hi->cb), &hi->cb, " ");
 
-		if (hi->invert_value && hi->type < HIDMAP_TYPE_ARR_LIST)
+		if (hi->invert_value)
 			data = hi->evtype == EV_REL
 			    ? -data
 			    : hi->lmin + hi->lmax - data;
@@ -273,6 +373,16 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 			 */
 			if (data == (hi->evtype == EV_REL ? 0 : hi->last_val))
 				continue;
+			if (hi->evtype == EV_ABS &&
+			    (hidmap_filter_abs(hi, &data) ||
+			    data == hi->last_val))
+				continue;
+			/* Do not arm coalescing callout past detach drain */
+			if (hi->evtype == EV_REL && hm->rel_coalesce != 0 &&
+			    hm->cb_state != HIDMAP_CB_IS_DETACHING) {
+				hidmap_coalesce_rel(hm, hi->code, data);
+				continue;
+			}
 			if (hi->evtype == EV_KEY)
 				hidmap_push_key(hm, hi->code, data);
 			else
@@ -282,6 +392,7 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 			break;
 
 		case HIDMAP_TYPE_ARR_LIST:
+		case HIDMAP_TYPE_ARR_RANGE:
 			key = KEY_RESERVED;
 			/*
 			 * 6.2.2.5. An out-of range value in an array field
@@ -293,40 +404,18 @@ hidmap_intr(void *context, void *buf, hid_size_t len)
 			 * 6.2.2.5. Rather than returning a single bit for each
 			 * button in the group, an array returns an index in
 			 * each field that corresponds to the pressed button.
+			 * Index to key code maps are built at attach time both
+			 * for arrays with lists and with not too wide ranges
+			 * of usages. Map is looked up for the wider ones.
 			 */
-			key = hi->codes[data - hi->lmin];
+			if (data - hi->lmin < hi->ncodes)
+				key = hi->codes != NULL ?
+				    hi->codes[data - hi->lmin] :
+				    hidmap_lookup_key(hm,
+				    data - hi->lmin + hi->umin);
 			if (key == KEY_RESERVED)
 				DPRINTF(hm, "Can not map unknown HID "
 				    "array index: %08x\n", data);
-			goto report_key;
-
-		case HIDMAP_TYPE_ARR_RANGE:
-			key = KEY_RESERVED;
-			/*
-			 * 6.2.2.5. An out-of range value in an array field
-			 * is considered no controls asserted.
-			 */
-			if (data < hi->lmin || data > hi->lmax)
-				goto report_key;
-			/*
-			 * When the input field is an array and the usage is
-			 * specified with a range instead of an ID, we have to
-			 * derive the actual usage by using the item value as
-			 * an index in the usage range list.
-			 */
-			usage = data - hi->lmin + hi->umin;
-			found = false;
-			HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
-				if (usage == mi->usage + uoff &&
-				    mi->type == EV_KEY && !mi->has_cb) {
-					key = mi->code;
-					found = true;
-					break;
-				}
-			}
-			if (!found)
-				DPRINTF(hm, "Can not map unknown HID "
-				    "usage: %08x\n", usage);
 report_key:
 			if (key == HIDMAP_KEY_NULL || key == hi->last_key)
 				continue;
@@ -343,10 +432,23 @@ report_key:
 		do_sync = true;
 	}
 
+	/* Run callbacks that not tied to HID items */
+	for (hi = hm->hid_items + hm->rid_idx[HIDMAP_NRIDS];
+	     hi < hm->hid_items + hm->nhid_items;
+	     hi++) {
+		DPRINTFN(hm, 6, "type=%d item=%*D\n", hi->type,
+		    (int)sizeof(hi->cb), &hi->cb, " ");
+		if (hi->cb(hm, hi, (union hidmap_cb_ctx){.rid = id}) == 0)
+			do_sync = true;
+	}
+
 	if (do_sync) {
-		if (HIDMAP_WANT_MERGE_KEYS(hm))
-			hidmap_sync_keys(hm);
-		evdev_sync(hm->evdev);
+		/* Deliver coalesced motion no later than button changes */
+		if (hm->rel_pending != 0) {
+			callout_stop(&hm->rel_callout);
+			hidmap_flush_rel(hm);
+		}
+		hidmap_sync(hm, time);
 	}
 }
 
@@ -557,12 +659,84 @@ hidmap_add_map(struct hidmap *hm, const struct hidmap_item *map,
 	return (0);
 }
 
+/*
+ * Seed noise filter of absolute axis from the map. Drivers of analog
+ * controls with unknown noise level may ask to derive fuzz from logical
+ * range the same way Linux does for joysticks. Axes narrower than 64 units
+ * are left unfiltered as every step of them is significant. Evdev is not
+ * told about the fuzz to avoid filtering values twice.
+ */
+static void
+hidmap_init_abs_filter(struct hidmap_hid_item *item,
+    const struct hidmap_item *mi, const struct hid_item *hi)
+{
+	int64_t range;
+
+	item->fuzz = mi->fuzz;
+	item->deadzone = 0;
+
+	range = (int64_t)hi->logical_maximum - hi->logical_minimum;
+	if (mi->derive_fuzz && item->fuzz == 0 &&
+	    range >= HIDMAP_FUZZ_MIN << 5)
+		item->fuzz = MAX(range >> 8, HIDMAP_FUZZ_MIN);
+}
+
+/*
+ * Export per-axis noise filter settings as dev.<driver>.<unit>.abs.<code>
+ * sysctls. They have to be created after final placement of HID items.
+ */
+static void
+hidmap_add_abs_sysctls(struct hidmap *hm)
+{
+	struct hidmap_hid_item *hi, *prev;
+	struct sysctl_oid *tree, *node;
+	char name[16];
+	u_int dup;
+
+	tree = NULL;
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if ((hi->type != HIDMAP_TYPE_VARIABLE &&
+		    hi->type != HIDMAP_TYPE_VAR_NULLST) ||
+		    hi->evtype != EV_ABS)
+			continue;
+		if (tree == NULL)
+			tree = SYSCTL_ADD_NODE(&hm->abs_ctx,
+			    SYSCTL_CHILDREN(device_get_sysctl_tree(hm->dev)),
+			    OID_AUTO, "abs", CTLFLAG_RD, NULL,
+			    "absolute axes noise filters");
+		/*
+		 * The same event code may be reported by several items, e.g.
+		 * X and Y axes duplicated in different report IDs. Name the
+		 * first one after the code and append its ordinal to others.
+		 */
+		dup = 0;
+		for (prev = hm->hid_items; prev < hi; prev++)
+			if ((prev->type == HIDMAP_TYPE_VARIABLE ||
+			    prev->type == HIDMAP_TYPE_VAR_NULLST) &&
+			    prev->evtype == EV_ABS && prev->code == hi->code)
+				dup++;
+		if (dup == 0)
+			snprintf(name, sizeof(name), "%u", hi->code);
+		else
+			snprintf(name, sizeof(name), "%u_%u", hi->code, dup);
+		node = SYSCTL_ADD_NODE(&hm->abs_ctx, SYSCTL_CHILDREN(tree),
+		    OID_AUTO, name, CTLFLAG_RD, NULL, "ABS_* event code");
+		SYSCTL_ADD_INT(&hm->abs_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+		    "fuzz", CTLFLAG_RWTUN, &hi->fuzz, 0,
+		    "ignore value changes smaller than this");
+		SYSCTL_ADD_INT(&hm->abs_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+		    "deadzone", CTLFLAG_RWTUN, &hi->deadzone, 0,
+		    "report center for values this close to it");
+	}
+}
+
 static bool
 hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
     struct hidmap_hid_item *item)
 {
 	const struct hidmap_item *mi;
 	struct hidmap_hid_item hi_temp;
+	int64_t range;
 	int32_t arr_size, usage;
 	uint32_t i;
 	uint16_t uoff;
@@ -605,12 +779,13 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 					    item->code);
 					break;
 				case EV_ABS:
+					hidmap_init_abs_filter(item, mi, hi);
 					evdev_support_event(hm->evdev, EV_ABS);
 					evdev_support_abs(hm->evdev,
 					    item->code, 0,
 					    hi->logical_minimum,
 					    hi->logical_maximum,
-					    mi->fuzz,
+					    0,	/* Filtered by hidmap */
 					    mi->flat,
 					    hid_item_resolution(hi));
 					break;
@@ -637,7 +812,31 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 		}
 		if (!found)
 			return (false);
+		/*
+		 * When the input field is an array and the usage is
+		 * specified with a range instead of an ID, we have to
+		 * derive the actual usage by using the item value as
+		 * an index in the usage range list. Precompute the
+		 * index to key code map to avoid map lookups in
+		 * interrupt handler.
+		 */
+		range = MIN((int64_t)hi->logical_maximum -
+		    hi->logical_minimum, (int64_t)hi->usage_maximum -
+		    hi->usage_minimum) + 1;
+		if (range < 1)
+			return (false);
+		/* Usage range can not span more than one usage page */
+		arr_size = MIN(range, HID_USAGE2(1, 0));
+		item->ncodes = arr_size;
 		item->umin = hi->usage_minimum;
+		/* Do not let descriptor make us allocate 128k per item */
+		if (arr_size <= HIDMAP_MAX_CODES) {
+			item->codes = malloc(arr_size * sizeof(uint16_t),
+			    M_DEVBUF, M_WAITOK);
+			for (i = 0; i < arr_size; i++)
+				item->codes[i] = hidmap_lookup_key(hm,
+				    hi->usage_minimum + i);
+		}
 		item->type = HIDMAP_TYPE_ARR_RANGE;
 		item->last_key = KEY_RESERVED;
 		goto mapped;
@@ -658,10 +857,12 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 		HIDMAP_FOREACH_ITEM(hm, mi, uoff) {
 			if (can_map_arr_list(hi, mi, usage, uoff)) {
 				hidmap_support_key(hm, mi->code + uoff);
-				if (item->codes == NULL)
+				if (item->codes == NULL) {
 					item->codes = malloc(
 					    arr_size * sizeof(uint16_t),
 					    M_DEVBUF, M_WAITOK | M_ZERO);
+					item->ncodes = arr_size;
+				}
 				item->codes[i] = mi->code + uoff;
 				found = true;
 				break;
@@ -675,10 +876,20 @@ hidmap_parse_hid_item(struct hidmap *hm, struct hid_item *hi,
 
 mapped:
 	item->id = hi->report_ID;
-	item->loc = hi->loc;
-	item->loc.count = 1;
+	hid_field_init(&item->field, &hi->loc);
+	item->field.loc.count = 1;
 	item->lmin = hi->logical_minimum;
 	item->lmax = hi->logical_maximum;
+	/*
+	 * 5.8. If Logical Minimum and Logical Maximum are both
+	 * positive values then the contents of a field can be assumed
+	 * to be an unsigned value. Otherwise, all integer values are
+	 * signed values represented in 2’s complement format.
+	 */
+	item->is_signed = item->lmin < 0 || item->lmax < 0;
+	/* Value inversion is applicable to variable items only */
+	if (item->type >= HIDMAP_TYPE_ARR_LIST)
+		item->invert_value = false;
 
 	DPRINTFN(hm, 6, "usage=%04x id=%d loc=%u/%u type=%d item=%*D\n",
 	    hi->usage, hi->report_ID, hi->loc.pos, hi->loc.size, item->type,
@@ -687,6 +898,46 @@ mapped:
 	return (true);
 }
 
+/*
+ * Group preparsed HID items by report ID to let interrupt handler process
+ * only items belonging to received report. Finalizing callbacks are moved
+ * to the end of the list as they are run for every report.
+ */
+static void
+hidmap_build_schedule(struct hidmap *hm)
+{
+	struct hidmap_hid_item *items, *hi;
+	uint32_t *idx, nfinal;
+	u_int id;
+
+	idx = malloc((HIDMAP_NRIDS + 1) * sizeof(uint32_t), M_DEVBUF,
+	    M_WAITOK | M_ZERO);
+	items = malloc(hm->nhid_items * sizeof(struct hidmap_hid_item),
+	    M_DEVBUF, M_WAITOK | M_ZERO);
+
+	/* Count items per report ID and turn counters to start offsets */
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++)
+		if (hi->type != HIDMAP_TYPE_FINALCB)
+			idx[hi->id + 1]++;
+	for (id = 1; id <= HIDMAP_NRIDS; id++)
+		idx[id] += idx[id - 1];
+	nfinal = idx[HIDMAP_NRIDS];
+
+	/* Stable scatter. Offsets are shifted by one report ID after it */
+	for (hi = hm->hid_items; hi < hm->hid_items + hm->nhid_items; hi++) {
+		if (hi->type == HIDMAP_TYPE_FINALCB)
+			items[nfinal++] = *hi;
+		else
+			items[idx[hi->id]++] = *hi;
+	}
+	memmove(idx + 1, idx, HIDMAP_NRIDS * sizeof(uint32_t));
+	idx[0] = 0;
+
+	free(hm->hid_items, M_DEVBUF);
+	hm->hid_items = items;
+	hm->rid_idx = idx;
+}
+
 static int
 hidmap_parse_hid_descr(struct hidmap *hm, uint8_t tlc_index)
 {
@@ -743,6 +994,8 @@ hidmap_parse_hid_descr(struct hidmap *hm, uint8_t tlc_index)
 		    "result=%td\n", hm->nhid_items, item - hm->hid_items);
 	hm->nhid_items = item - hm->hid_items;
 
+	hidmap_build_schedule(hm);
+
 	if (HIDMAP_WANT_MERGE_KEYS(hm))
 		bzero(hm->key_press, howmany(KEY_CNT, 8));
 
@@ -776,10 +1029,8 @@ int
 hidmap_attach(struct hidmap* hm)
 {
 	const struct hid_device_info *hw = hid_get_device_info(hm->dev);
-#ifdef HID_DEBUG
 	char tunable[40];
-#endif
-	int error;
+	int error, tstamps = 0;
 
 #ifdef HID_DEBUG
 	if (hm->debug_var == NULL) {
@@ -797,6 +1048,8 @@ hidmap_attach(struct hidmap* hm)
 	DPRINTFN(hm, 11, "hm=%p\n", hm);
 
 	hm->cb_state = HIDMAP_CB_IS_ATTACHING;
+	sysctl_ctx_init(&hm->abs_ctx);
+	callout_init_mtx(&hm->rel_callout, hidbus_get_lock(hm->dev), 0);
 
 	hm->hid_items = malloc(hm->nhid_items * sizeof(struct hid_item),
 	    M_DEVBUF, M_WAITOK | M_ZERO);
@@ -814,6 +1067,20 @@ hidmap_attach(struct hidmap* hm)
 	    hw->idVersion);
 	evdev_set_serial(hm->evdev, hw->serial);
 	evdev_support_event(hm->evdev, EV_SYN);
+
+	/*
+	 * Export transport timestamps. Drivers which report hardware
+	 * timestamps on their own reset do_timestamps in attach callbacks.
+	 */
+	snprintf(tunable, sizeof(tunable), "hw.hid.%s.timestamps",
+	    device_get_name(hm->dev));
+	TUNABLE_INT_FETCH(tunable, &tstamps);
+	if (tstamps != 0) {
+		hm->do_timestamps = true;
+		evdev_support_event(hm->evdev, EV_MSC);
+		evdev_support_msc(hm->evdev, MSC_TIMESTAMP);
+	}
+
 	error = hidmap_parse_hid_descr(hm, hidbus_get_index(hm->dev));
 	if (error) {
 		DPRINTF(hm, "error=%d\n", error);
@@ -821,6 +1088,8 @@ hidmap_attach(struct hidmap* hm)
 		return (ENXIO);
 	}
 
+	hidmap_add_abs_sysctls(hm);
+
 	evdev_set_methods(hm->evdev, hm->dev, &hm->evdev_methods);
 	hm->cb_state = HIDMAP_CB_IS_RUNNING;
 
@@ -841,9 +1110,19 @@ hidmap_detach(struct hidmap* hm)
 
 	DPRINTFN(hm, 11, "\n");
 
+	/*
+	 * Interrupts are still running here. Switch state under hidbus lock
+	 * so hidmap_intr() can not re-arm relative motion callout after it
+	 * has been drained.
+	 */
+	mtx_lock(hidbus_get_lock(hm->dev));
 	hm->cb_state = HIDMAP_CB_IS_DETACHING;
+	mtx_unlock(hidbus_get_lock(hm->dev));
 
+	callout_drain(&hm->rel_callout);
 	evdev_free(hm->evdev);
+	/* Filter knobs point into HID items */
+	sysctl_ctx_free(&hm->abs_ctx);
 	if (hm->hid_items != NULL) {
 		for (hi = hm->hid_items;
 		     hi < hm->hid_items + hm->nhid_items;
@@ -851,10 +1130,12 @@ hidmap_detach(struct hidmap* hm)
 			if (hi->type == HIDMAP_TYPE_FINALCB ||
 			    hi->type == HIDMAP_TYPE_CALLBACK)
 				hi->cb(hm, hi, (union hidmap_cb_ctx){});
-			else if (hi->type == HIDMAP_TYPE_ARR_LIST)
+			else if (hi->type == HIDMAP_TYPE_ARR_LIST ||
+			    hi->type == HIDMAP_TYPE_ARR_RANGE)
 				free(hi->codes, M_DEVBUF);
 		free(hm->hid_items, M_DEVBUF);
 	}
+	free(hm->rid_idx, M_DEVBUF);
 
 	free(hm->key_press, M_DEVBUF);
 	free(hm->key_rel, M_DEVBUF);
@@ -29,10 +29,15 @@
 #define _HIDMAP_H_
 
 #include <sys/param.h>
+#include <sys/callout.h>
+#include <sys/sysctl.h>
+
+#include <dev/evdev/input.h>
 
 #include "hid.h"
 
 #define	HIDMAP_MAX_MAPS	4
+#define	HIDMAP_NRIDS	256	/* Number of distinct report IDs */
 
 struct hid_device_id;
 struct hidmap_hid_item;
@@ -74,6 +79,7 @@ typedef int hidmap_cb_t(HIDMAP_CB_ARGS);
 	hid_get_data(hm->intr_buf, hm->intr_len, (loc))
 #define	HIDMAP_CB_GET_UDATA(loc)					\
 	hid_get_udata(hm->intr_buf, hm->intr_len, (loc))
+#define	HIDMAP_CB_GET_TIME(...)	(hm->intr_time)
 
 enum hidmap_relabs {
 	HIDMAP_RELABS_ANY = 0,
@@ -86,7 +92,7 @@ struct hidmap_item {
 		struct {
 			uint16_t	type;	/* Evdev event type */
 			uint16_t	code;	/* Evdev event code */
-			uint16_t	fuzz;	/* Evdev event fuzz */
+			uint16_t	fuzz;	/* Abs. change threshold */
 			uint16_t	flat;	/* Evdev event flat */
 		};
 		hidmap_cb_t		*cb;	/* Reporting callback */
@@ -98,7 +104,8 @@ struct hidmap_item {
 	bool			has_cb:1;
 	bool			final_cb:1;
 	bool			invert_value:1;
-	u_int			reserved:10;
+	bool			derive_fuzz:1;	/* fuzz from range */
+	u_int			reserved:9;
 };
 
 #define	HIDMAP_ANY(_page, _usage, _type, _code)				\
@@ -167,8 +174,7 @@ struct hidmap_hid_item {
 			uint16_t	evtype;	/* Evdev event type */
 			uint16_t	code;	/* Evdev event code */
 		};
-		uint16_t	*codes;		/* Array list map type */
-		int32_t		umin;		/* Array range map type */
+		uint16_t	*codes;		/* Array map types */
 	};
 	union {
 		void		*udata;		/* Callback private context */
@@ -176,12 +182,17 @@ struct hidmap_hid_item {
 		int32_t		last_val;	/* Last reported value (var) */
 		uint16_t	last_key;	/* Last reported key (array) */
 	};
-	struct hid_location	loc;		/* HID item location */
+	struct hid_field	field;		/* HID item location */
 	int32_t			lmin;		/* HID item logical minimum */
 	int32_t			lmax;		/* HID item logical maximum */
+	uint32_t		ncodes;		/* Size of array map */
+	int32_t			umin;		/* Array range w/o map */
+	int32_t			fuzz;		/* Abs. change threshold */
+	int32_t			deadzone;	/* Abs. snap-to-center range */
 	enum hidmap_type	type:8;
 	uint8_t			id;		/* Report ID */
 	bool			invert_value;
+	bool			is_signed;	/* Field is 2's complement */
 };
 
 struct hidmap {
@@ -198,6 +209,12 @@ struct hidmap {
 	/* List of preparsed HID items */
 	uint32_t		nhid_items;
 	struct hidmap_hid_item	*hid_items;
+	/*
+	 * Items grouped by report ID. Items of report #id are stored in
+	 * [rid_idx[id], rid_idx[id + 1]) range. Finalizing callbacks are
+	 * placed after them starting from rid_idx[HIDMAP_NRIDS] index.
+	 */
+	uint32_t		*rid_idx;
 
 	/* Key event merging buffers */
 	uint8_t			*key_press;
@@ -205,11 +222,22 @@ struct hidmap {
 	uint16_t		key_min;
 	uint16_t		key_max;
 
+	struct sysctl_ctx_list	abs_ctx;	/* Per-axis filter knobs */
+
+	/* Relative motion coalescing */
+	struct callout		rel_callout;
+	sbintime_t		rel_coalesce;	/* Flush interval, 0 - off */
+	sbintime_t		rel_time;	/* Last coalesced report time */
+	uint32_t		rel_pending;	/* Bitmask of REL_* codes */
+	int32_t			rel_accum[REL_CNT];
+
 	int			*debug_var;
 	int			debug_level;
 	enum hidmap_cb_state	cb_state;
 	void *			intr_buf;
 	hid_size_t		intr_len;
+	sbintime_t		intr_time;	/* Report arrival time */
+	bool			do_timestamps;	/* Push MSC_TIMESTAMP */
 };
 
 typedef	uint8_t *		hidmap_caps_t;
@@ -249,7 +277,9 @@ uint32_t	hidmap_add_map(struct hidmap *hm,
 void	hidmap_support_key(struct hidmap *hm, uint16_t key);
 void	hidmap_push_key(struct hidmap *hm, uint16_t key, int32_t value);
 
-void	hidmap_intr(void *context, void *buf, hid_size_t len);
+void	hidmap_intr(void *context, void *buf, hid_size_t len,
+	    sbintime_t time);
+void	hidmap_set_rel_coalesce(struct hidmap *hm, sbintime_t interval);
 #define	HIDMAP_PROBE(hm, dev, id, map, suffix)				\
 	hidmap_probe((hm), (dev), (id), nitems(id), (map), nitems(map),	\
 	    (suffix), NULL)
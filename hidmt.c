@@ -0,0 +1,156 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2020 Vladimir Kondratyev <wulf@FreeBSD.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+/*
+ * Multi-touch protocol type B slot engine shared by hmt(4) and hetp.
+ * https://www.kernel.org/doc/Documentation/input/multi-touch-protocol.txt
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/module.h>
+
+#include <dev/evdev/input.h>
+#include <dev/evdev/evdev.h>
+
+#include "hidmt.h"
+
+/*
+ * Prepare engine for evdev device. autorel must match presence of
+ * EVDEV_FLAG_MT_AUTOREL as in that case evdev releases slots which were not
+ * reported in a frame on its own.
+ */
+void
+hidmt_init(struct hidmt *mt, struct evdev_dev *evdev, bool autorel)
+{
+	bzero(mt, sizeof(*mt));
+	mt->evdev = evdev;
+	mt->autorel = autorel;
+}
+
+/*
+ * Register per-contact property stored at given index of contact data
+ * and reported as ABS_MT_* event code. ABS_MT_SLOT is pushed by the engine.
+ */
+void
+hidmt_add_prop(struct hidmt *mt, uint8_t index, uint16_t code)
+{
+	KASSERT(mt->nprops < HIDMT_MAX_PROPS, ("too many MT properties"));
+	KASSERT(code != ABS_MT_SLOT, ("ABS_MT_SLOT is not a property"));
+
+	mt->prop[mt->nprops] = index;
+	mt->code[mt->nprops] = code;
+	mt->nprops++;
+}
+
+/*
+ * Push contact data to evdev as MT protocol type B slot. Values that did not
+ * change since the last frame are skipped and ABS_MT_SLOT is only pushed if
+ * anything else is.
+ */
+void
+hidmt_push_contact(struct hidmt *mt, int32_t slot, const uint32_t *data)
+{
+	uint32_t i, value;
+	bool valid, slot_pushed = false;
+
+	valid = isset(mt->valid, slot);
+
+	/* Auto-released slots must be touched in every frame to survive */
+	if (mt->autorel) {
+		evdev_push_abs(mt->evdev, ABS_MT_SLOT, slot);
+		slot_pushed = true;
+	}
+
+	for (i = 0; i < mt->nprops; i++) {
+		value = data[mt->prop[i]];
+		if (valid && mt->state[i][slot] == value)
+			continue;
+		if (!slot_pushed) {
+			evdev_push_abs(mt->evdev, ABS_MT_SLOT, slot);
+			slot_pushed = true;
+		}
+		evdev_push_abs(mt->evdev, mt->code[i], value);
+		mt->state[i][slot] = value;
+	}
+
+	setbit(mt->valid, slot);
+	setbit(mt->frame, slot);
+}
+
+/*
+ * Report lift of the finger. Slots that are already released are skipped.
+ */
+void
+hidmt_release_contact(struct hidmt *mt, int32_t slot)
+{
+	if (isclr(mt->valid, slot))
+		return;
+
+	evdev_push_abs(mt->evdev, ABS_MT_SLOT, slot);
+	evdev_push_abs(mt->evdev, ABS_MT_TRACKING_ID, -1);
+	clrbit(mt->valid, slot);
+}
+
+/*
+ * Unconditionally release first nslots slots, e.g. to recover from missed
+ * finger lift events.
+ */
+void
+hidmt_release_all(struct hidmt *mt, int32_t nslots)
+{
+	int32_t slot;
+
+	for (slot = 0; slot < nslots; slot++) {
+		evdev_push_abs(mt->evdev, ABS_MT_SLOT, slot);
+		evdev_push_abs(mt->evdev, ABS_MT_TRACKING_ID, -1);
+	}
+	bzero(mt->valid, sizeof(mt->valid));
+	bzero(mt->frame, sizeof(mt->frame));
+}
+
+/*
+ * Must be called before evdev_sync() at the end of every MT frame.
+ */
+void
+hidmt_end_frame(struct hidmt *mt)
+{
+	u_int i;
+
+	/* Forget slots evdev is going to auto-release on sync */
+	if (mt->autorel)
+		for (i = 0; i < nitems(mt->valid); i++)
+			mt->valid[i] &= mt->frame[i];
+	bzero(mt->frame, sizeof(mt->frame));
+}
+
+MODULE_DEPEND(hidmt, evdev, 1, 1, 1);
+MODULE_VERSION(hidmt, 1);
@@ -0,0 +1,64 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2020 Vladimir Kondratyev <wulf@FreeBSD.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HIDMT_H_
+#define _HIDMT_H_
+
+#include <sys/param.h>
+
+#include <dev/evdev/evdev.h>
+#include <dev/evdev/input.h>
+
+#define	HIDMT_MAX_PROPS	16	/* Per-contact properties except slot */
+
+/*
+ * MT protocol type B slot engine shared by multi-touch drivers. Drivers
+ * decode contacts into arrays of driver-defined layout and feed them slot
+ * by slot. Engine remembers values last pushed to every slot and reports
+ * only those which changed, so idle fingers cost nothing but a comparison.
+ */
+struct hidmt {
+	struct evdev_dev	*evdev;
+	uint8_t			prop[HIDMT_MAX_PROPS];	/* Contact data index */
+	uint16_t		code[HIDMT_MAX_PROPS];	/* ABS_MT_* code */
+	uint8_t			nprops;
+	bool			autorel;	/* EVDEV_FLAG_MT_AUTOREL set */
+	/* Last values pushed to evdev, indexed by property then by slot */
+	uint32_t		state[HIDMT_MAX_PROPS][MAX_MT_SLOTS];
+	uint8_t			valid[howmany(MAX_MT_SLOTS, 8)];
+	uint8_t			frame[howmany(MAX_MT_SLOTS, 8)];
+};
+
+void	hidmt_init(struct hidmt *mt, struct evdev_dev *evdev, bool autorel);
+void	hidmt_add_prop(struct hidmt *mt, uint8_t index, uint16_t code);
+void	hidmt_push_contact(struct hidmt *mt, int32_t slot,
+	    const uint32_t *data);
+void	hidmt_release_contact(struct hidmt *mt, int32_t slot);
+void	hidmt_release_all(struct hidmt *mt, int32_t nslots);
+void	hidmt_end_frame(struct hidmt *mt);
+
+#endif /* _HIDMT_H_ */
@@ -65,6 +65,8 @@ MODULE_VERSION(hidquirk, 1);
 #define	HID_DEV_QUIRKS_MAX 384
 #define	HID_SUB_QUIRKS_MAX 8
 #define	HID_QUIRK_ENVROOT "hw.hid.quirk."
+#define	HID_QUIRK_HASH_SIZE 128	/* must be power of 2 */
+#define	HID_QUIRK_END 0xffff	/* hash chain terminator */
 
 struct hidquirk_entry {
 	uint16_t bus;
@@ -77,6 +79,13 @@ struct hidquirk_entry {
 
 static struct mtx hidquirk_mtx;
 
+/*
+ * Quirk table index. Entries are chained in hash buckets keyed on bus, vendor
+ * and product ID. Each chain keeps all revision ranges of the same device.
+ */
+static uint16_t hidquirk_hash[HID_QUIRK_HASH_SIZE];	/* hidquirk_mtx */
+static uint16_t hidquirk_next[HID_DEV_QUIRKS_MAX];	/* hidquirk_mtx */
+
 #define	HID_QUIRK_VP(b,v,p,l,h,...) \
   { .bus = (b), .vid = (v), .pid = (p), .lo_rev = (l), .hi_rev = (h), \
     .quirks = { __VA_ARGS__ } }
@@ -212,6 +221,102 @@ hid_strquirk(const char *str, size_t len)
 	return (x);
 }
 
+/*------------------------------------------------------------------------*
+ *	hidquirk_hashkey
+ *
+ * Returns:
+ * Index of the hash chain for the given bus, vendor and product ID
+ *------------------------------------------------------------------------*/
+static __inline u_int
+hidquirk_hashkey(uint16_t bus, uint16_t vid, uint16_t pid)
+{
+	uint32_t key = (uint32_t)vid << 16 | pid;
+
+	return (((key ^ bus) * 0x9e3779b1u) >> 25 & (HID_QUIRK_HASH_SIZE - 1));
+}
+
+static bool
+hidquirk_entry_in_use(const struct hidquirk_entry *e)
+{
+	return ((e->bus | e->vid | e->pid | e->lo_rev | e->hi_rev) != 0);
+}
+
+static bool
+hidquirk_entry_has(const struct hidquirk_entry *e, uint16_t quirk)
+{
+	uint16_t y;
+
+	for (y = 0; y != HID_SUB_QUIRKS_MAX; y++)
+		if (e->quirks[y] == quirk)
+			return (true);
+
+	return (false);
+}
+
+/*------------------------------------------------------------------------*
+ *	hidquirk_link_entry
+ *
+ * This function inserts quirk table entry x at the head of its hash chain.
+ * The quirk mutex must be held.
+ *------------------------------------------------------------------------*/
+static void
+hidquirk_link_entry(uint16_t x)
+{
+	u_int h = hidquirk_hashkey(hidquirks[x].bus, hidquirks[x].vid,
+	    hidquirks[x].pid);
+
+	HID_MTX_ASSERT(&hidquirk_mtx, MA_OWNED);
+
+	hidquirk_next[x] = hidquirk_hash[h];
+	hidquirk_hash[h] = x;
+}
+
+#ifdef NOT_YET
+static void
+hidquirk_unlink_entry(uint16_t x)
+{
+	uint16_t *p;
+
+	HID_MTX_ASSERT(&hidquirk_mtx, MA_OWNED);
+
+	p = &hidquirk_hash[hidquirk_hashkey(hidquirks[x].bus,
+	    hidquirks[x].vid, hidquirks[x].pid)];
+	while (*p != HID_QUIRK_END) {
+		if (*p == x) {
+			*p = hidquirk_next[x];
+			break;
+		}
+		p = &hidquirk_next[*p];
+	}
+	hidquirk_next[x] = HID_QUIRK_END;
+}
+#endif
+
+/*------------------------------------------------------------------------*
+ *	hidquirk_build_index
+ *
+ * This function rebuilds all hash chains from the quirk table, so that
+ * chains list entries in table order. The quirk mutex must be held.
+ *------------------------------------------------------------------------*/
+static void
+hidquirk_build_index(void)
+{
+	uint16_t x;
+
+	HID_MTX_ASSERT(&hidquirk_mtx, MA_OWNED);
+
+	for (x = 0; x != HID_QUIRK_HASH_SIZE; x++)
+		hidquirk_hash[x] = HID_QUIRK_END;
+	/* Link in reverse order to keep chains sorted by table position */
+	for (x = HID_DEV_QUIRKS_MAX; x-- != 0; ) {
+		hidquirk_next[x] = HID_QUIRK_END;
+		/* The last entry is reserved for all-zero device */
+		if (hidquirk_entry_in_use(hidquirks + x) ||
+		    x == HID_DEV_QUIRKS_MAX - 1)
+			hidquirk_link_entry(x);
+	}
+}
+
 /*------------------------------------------------------------------------*
  *	hid_test_quirk_by_info
  *
@@ -222,42 +327,43 @@ hid_strquirk(const char *str, size_t len)
 bool
 hid_test_quirk_by_info(const struct hid_device_info *info, uint16_t quirk)
 {
-	uint16_t x;
-	uint16_t y;
+	const struct hidquirk_entry *e;
+	uint16_t pid, x;
 
 	if (quirk == HQ_NONE)
 		goto done;
 
 	HID_MTX_LOCK(&hidquirk_mtx);
 
-	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
-		/* see if quirk information does not match */
-		if ((hidquirks[x].bus != info->idBus) ||
-		    (hidquirks[x].vid != info->idVendor) ||
-		    (hidquirks[x].lo_rev > info->idVersion) ||
-		    (hidquirks[x].hi_rev < info->idVersion)) {
-			continue;
-		}
-		/* see if quirk only should match vendor ID */
-		if (hidquirks[x].pid != info->idProduct) {
-			if (hidquirks[x].pid != 0)
+	/* Look for product entries first, then for vendor-only ones */
+	pid = info->idProduct;
+	for (;;) {
+		x = hidquirk_hash[hidquirk_hashkey(info->idBus,
+		    info->idVendor, pid)];
+		for (; x != HID_QUIRK_END; x = hidquirk_next[x]) {
+			e = hidquirks + x;
+			/* see if quirk information does not match */
+			if ((e->bus != info->idBus) ||
+			    (e->vid != info->idVendor) ||
+			    (e->pid != pid) ||
+			    (e->lo_rev > info->idVersion) ||
+			    (e->hi_rev < info->idVersion)) {
 				continue;
-
-			for (y = 0; y != HID_SUB_QUIRKS_MAX; y++) {
-				if (hidquirks[x].quirks[y] == HQ_MATCH_VENDOR_ONLY)
-					break;
 			}
-			if (y == HID_SUB_QUIRKS_MAX)
+			/* see if quirk only should match vendor ID */
+			if (e->pid != info->idProduct &&
+			    !hidquirk_entry_has(e, HQ_MATCH_VENDOR_ONLY))
 				continue;
-		}
-		/* lookup quirk */
-		for (y = 0; y != HID_SUB_QUIRKS_MAX; y++) {
-			if (hidquirks[x].quirks[y] == quirk) {
+			/* lookup quirk */
+			if (hidquirk_entry_has(e, quirk)) {
 				HID_MTX_UNLOCK(&hidquirk_mtx);
 				DPRINTF("Found quirk '%s'.\n", hidquirkstr(quirk));
 				return (true);
 			}
 		}
+		if (pid == 0)
+			break;
+		pid = 0;
 	}
 	HID_MTX_UNLOCK(&hidquirk_mtx);
 done:
@@ -277,7 +383,8 @@ hidquirk_get_entry(uint16_t bus, uint16_t vid, uint16_t pid,
 		return (hidquirks + HID_DEV_QUIRKS_MAX - 1);
 	}
 	/* search for an existing entry */
-	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
+	x = hidquirk_hash[hidquirk_hashkey(bus, vid, pid)];
+	for (; x != HID_QUIRK_END; x = hidquirk_next[x]) {
 		/* see if quirk information does not match */
 		if ((hidquirks[x].bus != bus) ||
 		    (hidquirks[x].vid != vid) ||
@@ -294,20 +401,16 @@ hidquirk_get_entry(uint16_t bus, uint16_t vid, uint16_t pid,
 		return (NULL);
 	}
 	/* search for a free entry */
-	for (x = 0; x != HID_DEV_QUIRKS_MAX; x++) {
+	for (x = 0; x != HID_DEV_QUIRKS_MAX - 1; x++) {
 		/* see if quirk information does not match */
-		if ((hidquirks[x].bus |
-		    hidquirks[x].vid |
-		    hidquirks[x].pid |
-		    hidquirks[x].lo_rev |
-		    hidquirks[x].hi_rev) != 0) {
+		if (hidquirk_entry_in_use(hidquirks + x))
 			continue;
-		}
 		hidquirks[x].bus = bus;
 		hidquirks[x].vid = vid;
 		hidquirks[x].pid = pid;
 		hidquirks[x].lo_rev = lo_rev;
 		hidquirks[x].hi_rev = hi_rev;
+		hidquirk_link_entry(x);
 
 		return (hidquirks + x);
 	}
@@ -444,8 +547,10 @@ hidquirk_ioctl(unsigned long cmd, caddr_t data,
 				break;
 			}
 		}
-		if (x == USB_SUB_QUIRKS_MAX) {
+		if (x == USB_SUB_QUIRKS_MAX &&
+		    pqe != hidquirks + HID_DEV_QUIRKS_MAX - 1) {
 			/* all quirk entries are unused - release */
+			hidquirk_unlink_entry(pqe - hidquirks);
 			memset(pqe, 0, sizeof(*pqe));
 		}
 		USB_MTX_UNLOCK(&hidquirk_mtx);
@@ -563,6 +668,10 @@ hidquirk_init(void *arg)
 	/* initialize mutex */
 	mtx_init(&hidquirk_mtx, "HID quirk", NULL, MTX_DEF);
 
+	HID_MTX_LOCK(&hidquirk_mtx);
+	hidquirk_build_index();
+	HID_MTX_UNLOCK(&hidquirk_mtx);
+
 	/* look for quirks defined by the environment variable */
 	for (i = 0; i != 100; i++) {
 		snprintf(envkey, sizeof(envkey), HID_QUIRK_ENVROOT "%d", i);
@@ -58,6 +58,15 @@ __FBSDID("$FreeBSD$");
 #include <sys/tty.h>
 #include <sys/uio.h>
 
+#include <machine/atomic.h>
+
+#include <vm/vm.h>
+#include <vm/vm_extern.h>
+#include <vm/vm_kern.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+#include <vm/vm_pager.h>
+
 #include "hid.h"
 #include "hidbus.h"
 #include "hidraw.h"
@@ -76,6 +85,14 @@ SYSCTL_INT(_hw_hid_hidraw, OID_AUTO, debug, CTLFLAG_RWTUN,
 
 #define	HIDRAW_INDEX		0xFF	/* Arbitrary high value */
 
+#define	HIDRAW_QSIZE_MIN	4	/* Input report queue depth limits */
+#define	HIDRAW_QSIZE_MAX	4096
+
+#define	HIDRAW_QSLOT(sc, i)				\
+	((struct hidraw_report_hdr *)((sc)->sc_q + (i) * (sc)->sc_qslot))
+
+#define	HIDRAW_OUTPUT_NSLOTS	4	/* Writes queued to transport */
+
 #define	HIDRAW_LOCAL_BUFSIZE	64	/* Size of on-stack buffer. */
 #define	HIDRAW_LOCAL_ALLOC(local_buf, size)		\
 	(sizeof(local_buf) > (size) ? (local_buf) :	\
@@ -88,16 +105,29 @@ SYSCTL_INT(_hw_hid_hidraw, OID_AUTO, debug, CTLFLAG_RWTUN,
 struct hidraw_softc {
 	device_t sc_dev;		/* base device */
 
-	struct mtx *sc_mtx;		/* hidbus private mutex */
+	struct mtx *sc_mtx;		/* hidbus TLC mutex */
 
 	struct hid_rdesc_info *sc_rdesc;
 	const struct hid_device_info *sc_hw;
 
 	uint8_t *sc_q;
-	hid_size_t *sc_qlen;
+	hid_size_t sc_qslot;		/* Size of queue slot with header */
+	int sc_qsize;			/* Queue depth for open lifetime */
 	int sc_head;
 	int sc_tail;
 	int sc_sleepcnt;
+	uint32_t sc_qdrops;		/* Number of dropped reports */
+
+	int sc_qsize_def;		/* Per-device queue defaults */
+	int sc_drop_def;
+
+	/* Memory mapped input report ring */
+	vm_object_t sc_ring_obj;
+	struct hidraw_ring *sc_ring;
+	vm_size_t sc_ring_size;
+	uint32_t sc_ring_nslots;	/* Private copies of ring header */
+	uint32_t sc_ring_slotsize;
+	uint32_t sc_ring_tail;
 
 	struct selinfo sc_rsel;
 	struct proc *sc_async;	/* process that wants SIGIO */
@@ -110,6 +140,9 @@ struct hidraw_softc {
 		bool	uhid:1;		/* driver switched in to uhid mode */
 		bool	lock:1;		/* input queue sleepable lock */
 		bool	flush:1;	/* do not wait for data in read() */
+		bool	ring:1;		/* input reports go to mmap ring */
+		bool	batch:1;	/* read() returns many reports */
+		bool	drop:1;		/* drop oldest report on overflow */
 	} sc_state;
 	int sc_fflags;			/* access mode for open lifetime */
 
@@ -122,6 +155,7 @@ static d_write_t	hidraw_write;
 static d_ioctl_t	hidraw_ioctl;
 static d_poll_t		hidraw_poll;
 static d_kqfilter_t	hidraw_kqfilter;
+static d_mmap_single_t	hidraw_mmap_single;
 
 static d_priv_dtor_t	hidraw_dtor;
 
@@ -133,6 +167,7 @@ static struct cdevsw hidraw_cdevsw = {
 	.d_ioctl =	hidraw_ioctl,
 	.d_poll =	hidraw_poll,
 	.d_kqfilter =	hidraw_kqfilter,
+	.d_mmap_single = hidraw_mmap_single,
 	.d_name =	"hidraw",
 };
 
@@ -178,15 +213,36 @@ hidraw_probe(device_t self)
 	return (BUS_PROBE_GENERIC);
 }
 
+static int
+hidraw_sysctl_qsize(SYSCTL_HANDLER_ARGS)
+{
+	struct hidraw_softc *sc = arg1;
+	int error, value;
+
+	value = sc->sc_qsize_def;
+	error = sysctl_handle_int(oidp, &value, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	if (value < HIDRAW_QSIZE_MIN || value > HIDRAW_QSIZE_MAX)
+		return (EINVAL);
+
+	/* New depth takes effect on next open */
+	sc->sc_qsize_def = value;
+
+	return (0);
+}
+
 static int
 hidraw_attach(device_t self)
 {
 	struct hidraw_softc *sc = device_get_softc(self);
 	struct make_dev_args mda;
+	struct sysctl_oid *tree;
 	int error;
 
 	sc->sc_dev = self;
-	sc->sc_mtx = hidbus_get_lock(self);
+	sc->sc_mtx = hidbus_get_tlc_lock(self);
 
 	sc->sc_rdesc = hidbus_get_rdesc_info(self);
 	sc->sc_hw = hid_get_device_info(self);
@@ -197,6 +253,27 @@ hidraw_attach(device_t self)
 
 	knlist_init_mtx(&sc->sc_rsel.si_note, sc->sc_mtx);
 
+	/* Writes longer than output report size fall back to hid_write() */
+	if (sc->sc_rdesc->osize != 0)
+		(void)hidbus_output_init(self, HIDRAW_OUTPUT_NSLOTS, false);
+
+	sc->sc_qsize_def = HIDRAW_BUFFER_SIZE;
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(self),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(self)), OID_AUTO,
+	    "qsize", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 0,
+	    hidraw_sysctl_qsize, "I", "number of input reports buffered");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(self),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(self)), OID_AUTO,
+	    "drop_oldest", CTLFLAG_RWTUN, &sc->sc_drop_def, 0,
+	    "drop oldest report on queue overflow instead of stopping device");
+	tree = SYSCTL_ADD_NODE(device_get_sysctl_ctx(self),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(self)), OID_AUTO,
+	    "stats", CTLFLAG_RD, NULL, "statistics");
+	SYSCTL_ADD_U32(device_get_sysctl_ctx(self),
+	    SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "dropped", CTLFLAG_RD, &sc->sc_qdrops, 0,
+	    "number of input reports dropped on queue overflow");
+
 	make_dev_args_init(&mda);
 	mda.mda_flags = MAKEDEV_WAITOK;
 	mda.mda_devsw = &hidraw_cdevsw;
@@ -243,30 +320,183 @@ hidraw_detach(device_t self)
 	return (0);
 }
 
+/* Both input queue and mmap ring slots store report header before data */
+static inline hid_size_t
+hidraw_slot_size(struct hidraw_softc *sc)
+{
+	return (roundup2(sizeof(struct hidraw_report_hdr) +
+	    sc->sc_rdesc->rdsize, sizeof(uint64_t)));
+}
+
+static vm_size_t
+hidraw_ring_size(struct hidraw_softc *sc, uint32_t *nslots, uint32_t *slotsize)
+{
+	*nslots = 1u << fls(sc->sc_qsize - 1);
+	*slotsize = hidraw_slot_size(sc);
+
+	return (round_page(sizeof(struct hidraw_ring)) +
+	    round_page(*nslots * *slotsize));
+}
+
+/*
+ * Allocate input report ring backed by anonymous VM object. The object is
+ * wired in to kernel map for producer and shared with userland mappings by
+ * reference, so pages stay valid until the last mapping is gone.
+ */
+static int
+hidraw_ring_alloc(struct hidraw_softc *sc)
+{
+	struct hidraw_ring *ring;
+	vm_object_t obj;
+	vm_offset_t kva;
+	vm_size_t size;
+	uint32_t nslots, slotsize;
+	int rv;
+
+	if (sc->sc_ring != NULL)
+		return (0);
+
+	size = hidraw_ring_size(sc, &nslots, &slotsize);
+	obj = vm_pager_allocate(OBJT_PHYS, NULL, size,
+	    VM_PROT_READ | VM_PROT_WRITE, 0, curthread->td_ucred);
+	if (obj == NULL)
+		return (ENOMEM);
+
+	/* vm_map_find() consumes one reference on success */
+	vm_object_reference(obj);
+	kva = vm_map_min(kernel_map);
+	rv = vm_map_find(kernel_map, obj, 0, &kva, size, 0,
+	    VMFS_OPTIMAL_SPACE, VM_PROT_READ | VM_PROT_WRITE,
+	    VM_PROT_READ | VM_PROT_WRITE, 0);
+	if (rv != KERN_SUCCESS) {
+		vm_object_deallocate(obj);
+		vm_object_deallocate(obj);
+		return (ENOMEM);
+	}
+	rv = vm_map_wire(kernel_map, kva, kva + size,
+	    VM_MAP_WIRE_SYSTEM | VM_MAP_WIRE_NOHOLES);
+	if (rv != KERN_SUCCESS) {
+		vm_map_remove(kernel_map, kva, kva + size);
+		vm_object_deallocate(obj);
+		return (ENOMEM);
+	}
+
+	ring = (struct hidraw_ring *)kva;
+	ring->hr_nslots = nslots;
+	ring->hr_slotsize = slotsize;
+	ring->hr_offset = round_page(sizeof(struct hidraw_ring));
+
+	sc->sc_ring_obj = obj;
+	sc->sc_ring_size = size;
+	sc->sc_ring_nslots = nslots;
+	sc->sc_ring_slotsize = slotsize;
+	sc->sc_ring_tail = 0;
+	sc->sc_ring = ring;
+
+	return (0);
+}
+
+static void
+hidraw_ring_free(struct hidraw_softc *sc)
+{
+	vm_offset_t kva = (vm_offset_t)sc->sc_ring;
+
+	if (sc->sc_ring == NULL)
+		return;
+
+	vm_map_remove(kernel_map, kva, kva + sc->sc_ring_size);
+	vm_object_deallocate(sc->sc_ring_obj);
+	sc->sc_ring = NULL;
+	sc->sc_ring_obj = NULL;
+}
+
+/*
+ * Store input report in memory mapped ring. Only consumer index is taken
+ * from shared page. All other ring parameters are private kernel copies as
+ * userland can overwrite the header.
+ */
+static void
+hidraw_ring_put(struct hidraw_softc *sc, void *buf, hid_size_t len,
+    sbintime_t time)
+{
+	struct hidraw_ring *ring = sc->sc_ring;
+	struct hidraw_report_hdr *rh;
+	uint32_t tail;
+
+	tail = sc->sc_ring_tail;
+	if (tail - atomic_load_acq_32(&ring->hr_head) >= sc->sc_ring_nslots) {
+		DPRINTFN(3, "ring overflown. Drop report\n");
+		ring->hr_dropped++;
+		return;
+	}
+
+	len = MIN(len, sc->sc_ring_slotsize - sizeof(*rh));
+	rh = (struct hidraw_report_hdr *)((uint8_t *)ring +
+	    round_page(sizeof(struct hidraw_ring)) +
+	    (tail & (sc->sc_ring_nslots - 1)) * sc->sc_ring_slotsize);
+	rh->rh_len = len;
+	rh->rh_id = sc->sc_rdesc->iid != 0 && len > 0 ? *(uint8_t *)buf : 0;
+	rh->rh_time = sbttons(time);
+	bcopy(buf, rh + 1, len);
+
+	sc->sc_ring_tail = tail + 1;
+	atomic_store_rel_32(&ring->hr_tail, sc->sc_ring_tail);
+}
+
+static inline bool
+hidraw_has_data(struct hidraw_softc *sc)
+{
+
+	mtx_assert(sc->sc_mtx, MA_OWNED);
+
+	if (sc->sc_state.ring)
+		return (sc->sc_ring_tail !=
+		    atomic_load_acq_32(&sc->sc_ring->hr_head));
+
+	return (sc->sc_head != sc->sc_tail);
+}
+
 void
-hidraw_intr(void *context, void *buf, hid_size_t len)
+hidraw_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
 {
 	struct hidraw_softc *sc = context;
+	struct hidraw_report_hdr *rh;
 	int next;
 
 	DPRINTFN(5, "len=%d\n", len);
 	DPRINTFN(5, "data = %*D\n", len, buf, " ");
 
-	next = (sc->sc_tail + 1) % HIDRAW_BUFFER_SIZE;
-	if (next == sc->sc_head)
+	if (sc->sc_state.ring) {
+		hidraw_ring_put(sc, buf, len, time);
+		hidraw_notify(sc);
 		return;
+	}
+
+	next = (sc->sc_tail + 1) % sc->sc_qsize;
+	if (next == sc->sc_head) {
+		sc->sc_qdrops++;
+		/*
+		 * Discard the oldest report if requested. It is not possible
+		 * while reader holds queue lock as it can copy the head slot.
+		 */
+		if (!sc->sc_state.drop || sc->sc_state.lock)
+			return;
+		sc->sc_head = (sc->sc_head + 1) % sc->sc_qsize;
+	}
 
-	bcopy(buf, sc->sc_q + sc->sc_tail * sc->sc_rdesc->rdsize, len);
+	rh = HIDRAW_QSLOT(sc, sc->sc_tail);
+	rh->rh_len = len;
+	rh->rh_id = sc->sc_rdesc->iid != 0 && len > 0 ? *(uint8_t *)buf : 0;
+	rh->rh_time = sbttons(time);
+	bcopy(buf, rh + 1, len);
 
 	/* Make sure we don't process old data */
-	if (len < sc->sc_rdesc->rdsize)
-		bzero(sc->sc_q + sc->sc_tail * sc->sc_rdesc->rdsize + len,
-		    sc->sc_rdesc->isize - len);
+	if (len < sc->sc_rdesc->isize)
+		bzero((uint8_t *)(rh + 1) + len, sc->sc_rdesc->isize - len);
 
-	sc->sc_qlen[sc->sc_tail] = len;
 	sc->sc_tail = next;
 
-	if ((next + 1) % HIDRAW_BUFFER_SIZE == sc->sc_head) {
+	if (!sc->sc_state.drop && (next + 1) % sc->sc_qsize == sc->sc_head) {
 		DPRINTFN(3, "queue overflown. Stop intr");
 		sc->sc_state.owfl = true;
 		hidbus_intr_stop(sc->sc_dev);
@@ -344,9 +574,9 @@ hidraw_open(struct cdev *dev, int flag, int mode, struct thread *td)
 		return (error);
 	}
 
-	sc->sc_q = malloc(sc->sc_rdesc->rdsize * HIDRAW_BUFFER_SIZE, M_DEVBUF,
-	    M_ZERO | M_WAITOK);
-	sc->sc_qlen = malloc(sizeof(hid_size_t) * HIDRAW_BUFFER_SIZE, M_DEVBUF,
+	sc->sc_qsize = sc->sc_qsize_def;
+	sc->sc_qslot = hidraw_slot_size(sc);
+	sc->sc_q = malloc(sc->sc_qslot * sc->sc_qsize, M_DEVBUF,
 	    M_ZERO | M_WAITOK);
 
 	/* Set up interrupt pipe. */
@@ -356,6 +586,9 @@ hidraw_open(struct cdev *dev, int flag, int mode, struct thread *td)
 	sc->sc_async = 0;
 	sc->sc_state.uhid = false;	/* hidraw mode is default */
 	sc->sc_state.owfl = false;
+	sc->sc_state.ring = false;
+	sc->sc_state.batch = false;
+	sc->sc_state.drop = sc->sc_drop_def != 0;
 	sc->sc_head = sc->sc_tail = 0;
 	sc->sc_fflags = flag;
 	mtx_unlock(sc->sc_mtx);
@@ -376,11 +609,12 @@ hidraw_dtor(void *data)
 		hidbus_intr_stop(sc->sc_dev);
 	sc->sc_tail = sc->sc_head = 0;
 	sc->sc_async = 0;
+	sc->sc_state.ring = false;
 	mtx_unlock(sc->sc_mtx);
 
 	free(sc->sc_q, M_DEVBUF);
-	free(sc->sc_qlen, M_DEVBUF);
 	sc->sc_q = NULL;
+	hidraw_ring_free(sc);
 
 	mtx_lock(sc->sc_mtx);
 	sc->sc_state.open = false;
@@ -391,8 +625,9 @@ static int
 hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 {
 	struct hidraw_softc *sc;
+	struct hidraw_report_hdr *rh;
 	size_t length;
-	int error;
+	int error, head, tail;
 
 	DPRINTFN(1, "\n");
 
@@ -407,6 +642,12 @@ hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 		return (error);
 	}
 
+	/* Input reports are delivered through memory mapped ring */
+	if (sc->sc_state.ring) {
+		error = EBUSY;
+		goto exit;
+	}
+
 	if (sc->sc_state.immed) {
 		mtx_unlock(sc->sc_mtx);
 		DPRINTFN(1, "immed\n");
@@ -438,21 +679,54 @@ hidraw_read(struct cdev *dev, struct uio *uio, int flag)
 		}
 	}
 
+	/*
+	 * In batch mode transfer all pending reports which fit in to user
+	 * buffer prepending each one with header. Queue lock is held so
+	 * interrupt handler can only append reports after the snapshot.
+	 */
+	if (sc->sc_state.batch) {
+		head = sc->sc_head;
+		tail = sc->sc_tail;
+		mtx_unlock(sc->sc_mtx);
+		while (head != tail) {
+			rh = HIDRAW_QSLOT(sc, head);
+			length = sizeof(*rh) + rh->rh_len;
+			if (length > uio->uio_resid)
+				break;
+			error = uiomove(rh, length, uio);
+			if (error != 0)
+				break;
+			head = (head + 1) % sc->sc_qsize;
+		}
+		DPRINTFN(5, "got %d reports\n",
+		    (head - sc->sc_head + sc->sc_qsize) % sc->sc_qsize);
+		mtx_lock(sc->sc_mtx);
+		if (error == 0 && head == sc->sc_head && head != tail)
+			error = EMSGSIZE;
+		if (head != sc->sc_head && sc->sc_state.owfl) {
+			DPRINTFN(3, "queue freed. Start intr");
+			sc->sc_state.owfl = false;
+			hidbus_intr_start(sc->sc_dev);
+		}
+		sc->sc_head = head;
+		goto exit;
+	}
+
 	while (sc->sc_tail != sc->sc_head && uio->uio_resid > 0) {
+		rh = HIDRAW_QSLOT(sc, sc->sc_head);
 		length = min(uio->uio_resid, sc->sc_state.uhid ?
-		    sc->sc_rdesc->isize : sc->sc_qlen[sc->sc_head]);
+		    sc->sc_rdesc->isize : rh->rh_len);
 		mtx_unlock(sc->sc_mtx);
 
 		/* Copy the data to the user process. */
 		DPRINTFN(5, "got %lu chars\n", (u_long)length);
-		error = uiomove(sc->sc_q + sc->sc_head * sc->sc_rdesc->rdsize,
-		    length, uio);
+		error = uiomove(rh + 1, length, uio);
 
 		mtx_lock(sc->sc_mtx);
 		if (error != 0)
 			goto exit;
 		/* Remove a small chunk from the input queue. */
-		sc->sc_head = (sc->sc_head + 1) % HIDRAW_BUFFER_SIZE;
+		sc->sc_head = (sc->sc_head + 1) % sc->sc_qsize;
 		if (sc->sc_state.owfl) {
 			DPRINTFN(3, "queue freed. Start intr");
 			sc->sc_state.owfl = false;
@@ -512,6 +786,26 @@ hidraw_write(struct cdev *dev, struct uio *uio, int flag)
 		if (size > sc->sc_rdesc->wrsize)
 			return (ENOBUFS);
 	}
+
+	/*
+	 * Queue report to the transport and return once it is copied, so
+	 * writers updating device state at high rate are not serialized by
+	 * the bus transfers.
+	 */
+	error = hidbus_output_get(sc->sc_dev, size, (void **)&buf,
+	    (flag & O_NONBLOCK) != 0 ? M_NOWAIT : M_WAITOK);
+	if (error == 0) {
+		buf[0] = id;
+		error = uiomove(buf + buf_offset, uio->uio_resid, uio);
+		if (error == 0)
+			error = hidbus_output_submit(sc->sc_dev, buf, size);
+		else
+			hidbus_output_release(sc->sc_dev, buf);
+		return (error);
+	}
+	if (error != ENOBUFS)
+		return (error);
+
 	buf = HIDRAW_LOCAL_ALLOC(local_buf, size);
 	buf[0] = id;
 	error = uiomove(buf + buf_offset, uio->uio_resid, uio);
@@ -527,12 +821,12 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
     struct thread *td)
 {
 	uint8_t local_buf[HIDRAW_LOCAL_BUFSIZE];
-	void *buf;
+	void *buf, *oldbuf;
 	struct hidraw_softc *sc;
 	struct usb_gen_descriptor *ugd;
 	struct hidraw_report_descriptor *hrd;
 	struct hidraw_devinfo *hdi;
-	uint32_t size;
+	uint32_t size, nslots, slotsize;
 	int id, len;
 	int error = 0;
 
@@ -706,6 +1000,67 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 		hdi->vendor = sc->sc_hw->idVendor;
 		hdi->product = sc->sc_hw->idProduct;
 		return (0);
+
+	case HIDIOCSBATCH:
+		if (!(sc->sc_fflags & FREAD))
+			return (EPERM);
+		mtx_lock(sc->sc_mtx);
+		sc->sc_state.batch = *(int *)addr != 0;
+		mtx_unlock(sc->sc_mtx);
+		return (0);
+
+	case HIDIOCSQSIZE:
+		if (!(sc->sc_fflags & FREAD))
+			return (EPERM);
+		if (*(int *)addr < HIDRAW_QSIZE_MIN ||
+		    *(int *)addr > HIDRAW_QSIZE_MAX)
+			return (EINVAL);
+		mtx_lock(sc->sc_mtx);
+		error = hidraw_lock_queue(sc, true);
+		mtx_unlock(sc->sc_mtx);
+		if (error != 0)
+			return (error);
+		/* Queued reports are discarded */
+		buf = malloc(sc->sc_qslot * *(int *)addr, M_DEVBUF,
+		    M_ZERO | M_WAITOK);
+		mtx_lock(sc->sc_mtx);
+		oldbuf = sc->sc_q;
+		sc->sc_q = buf;
+		sc->sc_qsize = *(int *)addr;
+		sc->sc_tail = sc->sc_head = 0;
+		if (sc->sc_state.owfl) {
+			sc->sc_state.owfl = false;
+			hidbus_intr_start(sc->sc_dev);
+		}
+		hidraw_unlock_queue(sc);
+		mtx_unlock(sc->sc_mtx);
+		free(oldbuf, M_DEVBUF);
+		return (0);
+
+	case HIDIOCSQPOLICY:
+		if (!(sc->sc_fflags & FREAD))
+			return (EPERM);
+		if (*(int *)addr != HIDRAW_QPOLICY_STOP &&
+		    *(int *)addr != HIDRAW_QPOLICY_DROP_OLDEST)
+			return (EINVAL);
+		mtx_lock(sc->sc_mtx);
+		sc->sc_state.drop = *(int *)addr == HIDRAW_QPOLICY_DROP_OLDEST;
+		/* Overflown queue is not refilled in drop oldest mode */
+		if (sc->sc_state.drop && sc->sc_state.owfl) {
+			sc->sc_state.owfl = false;
+			hidbus_intr_start(sc->sc_dev);
+		}
+		mtx_unlock(sc->sc_mtx);
+		return (0);
+
+	case HIDIOCGRINGSIZE:
+		if (!(sc->sc_fflags & FREAD))
+			return (EPERM);
+		mtx_lock(sc->sc_mtx);
+		*(int *)addr = sc->sc_ring != NULL ? sc->sc_ring_size :
+		    hidraw_ring_size(sc, &nslots, &slotsize);
+		mtx_unlock(sc->sc_mtx);
+		return (0);
 	}
 
 	/* variable-length ioctls handling */
@@ -775,10 +1130,12 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 		error = hid_set_report_descr(sc->sc_dev, addr, len);
 		mtx_unlock(&Giant);
 		/* Realloc hidraw input queue */
-		if (error == 0)
+		if (error == 0) {
+			sc->sc_qslot = hidraw_slot_size(sc);
 			sc->sc_q = realloc(sc->sc_q,
-			    sc->sc_rdesc->rdsize * HIDRAW_BUFFER_SIZE,
+			    sc->sc_qslot * sc->sc_qsize,
 			    M_DEVBUF, M_ZERO | M_WAITOK);
+		}
 
 		/* Start interrupts again */
 		mtx_lock(sc->sc_mtx);
@@ -791,6 +1148,51 @@ hidraw_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int flag,
 	return (EINVAL);
 }
 
+static int
+hidraw_mmap_single(struct cdev *dev, vm_ooffset_t *offset, vm_size_t size,
+    struct vm_object **object, int nprot)
+{
+	struct hidraw_softc *sc;
+	int error;
+
+	sc = dev->si_drv1;
+	if (sc == NULL)
+		return (EIO);
+
+	if (!(sc->sc_fflags & FREAD) || (nprot & VM_PROT_EXECUTE) != 0)
+		return (EPERM);
+
+	mtx_lock(sc->sc_mtx);
+	error = hidraw_lock_queue(sc, false);
+	mtx_unlock(sc->sc_mtx);
+	if (error != 0)
+		return (error);
+
+	error = hidraw_ring_alloc(sc);
+	if (error == 0 && (*offset > sc->sc_ring_size ||
+	    size > sc->sc_ring_size - *offset))
+		error = EINVAL;
+
+	mtx_lock(sc->sc_mtx);
+	if (error == 0) {
+		vm_object_reference(sc->sc_ring_obj);
+		*object = sc->sc_ring_obj;
+		/* Switch from read(2) queue to the ring */
+		if (!sc->sc_state.ring) {
+			sc->sc_state.ring = true;
+			sc->sc_head = sc->sc_tail = 0;
+			if (sc->sc_state.owfl) {
+				sc->sc_state.owfl = false;
+				hidbus_intr_start(sc->sc_dev);
+			}
+		}
+	}
+	hidraw_unlock_queue(sc);
+	mtx_unlock(sc->sc_mtx);
+
+	return (error);
+}
+
 static int
 hidraw_poll(struct cdev *dev, int events, struct thread *td)
 {
@@ -805,7 +1207,7 @@ hidraw_poll(struct cdev *dev, int events, struct thread *td)
 		revents |= events & (POLLOUT | POLLWRNORM);
 	if (events & (POLLIN | POLLRDNORM) && (sc->sc_fflags & FREAD)) {
 		mtx_lock(sc->sc_mtx);
-		if (sc->sc_head != sc->sc_tail)
+		if (hidraw_has_data(sc))
 			revents |= events & (POLLIN | POLLRDNORM);
 		else {
 			sc->sc_state.sel = true;
@@ -856,7 +1258,7 @@ hidraw_kqread(struct knote *kn, long hint)
 		kn->kn_flags |= EV_EOF;
 		ret = 1;
 	} else
-		ret = (sc->sc_head != sc->sc_tail) ? 1 : 0;
+		ret = hidraw_has_data(sc) ? 1 : 0;
 
 	return (ret);
 }
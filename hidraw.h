@@ -32,7 +32,7 @@
 
 #include <sys/ioccom.h>
 
-#define	HIDRAW_BUFFER_SIZE	64	/* number of input reports buffered */
+#define	HIDRAW_BUFFER_SIZE	64	/* default number of input reports */
 #define	HID_MAX_DESCRIPTOR_SIZE	4096	/* artificial limit taken from Linux */
 
 struct hidraw_report_descriptor {
@@ -55,7 +55,52 @@ struct hidraw_devinfo {
 #define	HIDIOCGFEATURE(len)	_IOC(IOC_INOUT, 'U', 36, len)
 #define	HIDIOCGRAWUNIQ(len)	_IOC(IOC_OUT,   'U', 37, len)
 
+/*
+ * FreeBSD extension. Memory mapped input report ring.
+ * HIDIOCGRINGSIZE returns size of the ring to be passed to mmap(2) with
+ * zero offset. Once the ring is mapped, input reports are stored directly
+ * to it instead of read(2) queue. The kernel advances hr_tail after slot
+ * has been filled, userland advances hr_head after slot has been consumed.
+ * Both indices are free running and should be masked with hr_nslots - 1.
+ */
+struct hidraw_report_hdr {
+	uint16_t	rh_len;		/* Report length without header */
+	uint8_t		rh_id;		/* Report ID or 0 */
+	uint8_t		rh_flags;
+	uint32_t	rh_reserved;
+	uint64_t	rh_time;	/* Transport arrival uptime, ns */
+};
+
+struct hidraw_ring {
+	volatile uint32_t	hr_head;	/* Written by userland */
+	uint32_t		hr_pad0[15];
+	volatile uint32_t	hr_tail;	/* Written by kernel */
+	uint32_t		hr_pad1[15];
+	uint32_t		hr_nslots;	/* Number of slots, power of 2 */
+	uint32_t		hr_slotsize;	/* Slot size including header */
+	uint32_t		hr_offset;	/* Offset of the first slot */
+	volatile uint32_t	hr_dropped;	/* Reports lost on overflow */
+};
+
+#define	HIDRAW_RING_SLOT(r, i)						\
+	((struct hidraw_report_hdr *)((uint8_t *)(r) + (r)->hr_offset +	\
+	    ((i) & ((r)->hr_nslots - 1)) * (r)->hr_slotsize))
+
 /* FreeBSD extension. Set report descriptor. */
 #define	HIDIOCSRDESC(len)	_IOC(IOC_IN,    'U', 26, len)
+/* FreeBSD extension. Get size of memory mapped input report ring. */
+#define	HIDIOCGRINGSIZE		_IOR('U', 27, int)
+/*
+ * FreeBSD extension. Enable batch read(2) mode. Each read(2) call returns
+ * all queued reports which fit in to the buffer, each one is prepended
+ * with struct hidraw_report_hdr.
+ */
+#define	HIDIOCSBATCH		_IOW('U', 28, int)
+/* FreeBSD extension. Set input report queue depth for open lifetime. */
+#define	HIDIOCSQSIZE		_IOW('U', 29, int)
+/* FreeBSD extension. Set input report queue overflow policy. */
+#define	HIDRAW_QPOLICY_STOP		0	/* Stop device until drained */
+#define	HIDRAW_QPOLICY_DROP_OLDEST	1	/* Overwrite oldest report */
+#define	HIDIOCSQPOLICY		_IOW('U', 38, int)
 
 #endif	/* _HIDRAW_H */
@@ -110,6 +110,9 @@ SYSCTL_INT(_hw_hid_hkbd, OID_AUTO, no_leds, CTLFLAG_RWTUN,
 #define	HKBD_IN_BUF_FULL  ((HKBD_IN_BUF_SIZE / 2) - 1)	/* scancodes */
 #define	HKBD_NFKEY        (sizeof(fkey_tab)/sizeof(fkey_tab[0]))	/* units */
 #define	HKBD_BUFFER_SIZE	      64	/* bytes */
+#define	HKBD_NWORDS	(bitstr_size(HKBD_NKEYCODE) / sizeof(bitstr_t))
+#define	HKBD_NKEYIDS		       4	/* IDs having key masks */
+#define	HKBD_NKEYRUNS		       8	/* runs of bitmap keys */
 #define	HKBD_KEY_PRESSED(map, key) ({ \
 	CTASSERT((key) >= 0 && (key) < HKBD_NKEYCODE); \
 	bit_test(map, key); \
@@ -143,6 +146,19 @@ struct hkbd_softc {
 	/* Keycodes reported in array fields only */
 	bitstr_t bit_decl(sc_ndata0, HKBD_NKEYCODE);
 	bitstr_t bit_decl(sc_odata0, HKBD_NKEYCODE);
+	/* Keycodes grouped by report ID, 0 IDs means too many of them */
+	bitstr_t sc_key_mask[HKBD_NKEYIDS][HKBD_NWORDS];
+	uint8_t sc_key_ids[HKBD_NKEYIDS];
+	uint8_t sc_nkey_ids;
+	/* Contiguous 1-bit variable keys extracted from report at once */
+	struct {
+		struct hid_field field;
+		uint8_t key;
+		uint8_t id;
+	} sc_key_runs[HKBD_NKEYRUNS];
+	uint8_t sc_nkey_runs;
+	/* Variable keys not covered by runs */
+	bitstr_t bit_decl(sc_loc_key_slow, HKBD_NKEYCODE);
 
 	struct thread *sc_poll_thread;
 #ifdef EVDEV_SUPPORT
@@ -476,7 +492,9 @@ static void
 hkbd_interrupt(struct hkbd_softc *sc)
 {
 	const uint32_t now = sc->sc_time_ms;
+	bitstr_t diff;
 	unsigned key;
+	u_int i;
 
 	HKBD_LOCK_ASSERT(sc);
 
@@ -490,14 +508,18 @@ hkbd_interrupt(struct hkbd_softc *sc)
 	 * This allows devices which send events changing the state of
 	 * both a modifier key and a regular key, to be correctly translated.
 	 */
-	BIT_FOREACH(sc->sc_odata, HKBD_NKEYCODE, key) {
-		if (hkbd_is_modifier_key(key) || bit_test(sc->sc_ndata, key))
-			continue;
-		hkbd_put_key(sc, key | KEY_RELEASE);
+	for (i = 0; i < HKBD_NWORDS; i++) {
+		for (diff = sc->sc_odata[i] & ~sc->sc_ndata[i]; diff != 0;
+		    diff &= diff - 1) {
+			key = i * _BITSTR_BITS + ffsl(diff) - 1;
+			if (hkbd_is_modifier_key(key))
+				continue;
+			hkbd_put_key(sc, key | KEY_RELEASE);
 
-		/* clear repeating key, if any */
-		if (sc->sc_repeat_key == key)
-			sc->sc_repeat_key = 0;
+			/* clear repeating key, if any */
+			if (sc->sc_repeat_key == key)
+				sc->sc_repeat_key = 0;
+		}
 	}
 	BIT_FOREACH_AT(sc->sc_odata, MOD_MIN, MOD_MAX + 1, key)
 		if (!bit_test(sc->sc_ndata, key))
@@ -505,18 +527,22 @@ hkbd_interrupt(struct hkbd_softc *sc)
 	BIT_FOREACH_AT(sc->sc_ndata, MOD_MIN, MOD_MAX + 1, key)
 		if (!bit_test(sc->sc_odata, key))
 			hkbd_put_key(sc, key | KEY_PRESS);
-	BIT_FOREACH(sc->sc_ndata, HKBD_NKEYCODE, key) {
-		if (hkbd_is_modifier_key(key) || bit_test(sc->sc_odata, key))
-			continue;
-		hkbd_put_key(sc, key | KEY_PRESS);
+	for (i = 0; i < HKBD_NWORDS; i++) {
+		for (diff = sc->sc_ndata[i] & ~sc->sc_odata[i]; diff != 0;
+		    diff &= diff - 1) {
+			key = i * _BITSTR_BITS + ffsl(diff) - 1;
+			if (hkbd_is_modifier_key(key))
+				continue;
+			hkbd_put_key(sc, key | KEY_PRESS);
 
-		sc->sc_co_basetime = sbinuptime();
-		sc->sc_delay = sc->sc_kbd.kb_delay1;
-		hkbd_start_timer(sc);
+			sc->sc_co_basetime = sbinuptime();
+			sc->sc_delay = sc->sc_kbd.kb_delay1;
+			hkbd_start_timer(sc);
 
-		/* set repeat time for last key */
-		sc->sc_repeat_time = now + sc->sc_kbd.kb_delay1;
-		sc->sc_repeat_key = key;
+			/* set repeat time for last key */
+			sc->sc_repeat_time = now + sc->sc_kbd.kb_delay1;
+			sc->sc_repeat_key = key;
+		}
 	}
 
 	/* synchronize old data with new data */
@@ -614,11 +640,12 @@ hkbd_apple_swap(uint32_t keycode)
 }
 
 static void
-hkbd_intr_callback(void *context, void *data, hid_size_t len)
+hkbd_intr_callback(void *context, void *data, hid_size_t len,
+    sbintime_t time)
 {
 	struct hkbd_softc *sc = context;
 	uint8_t *buf = data;
-	uint32_t i;
+	uint32_t i, j, bits;
 	uint8_t id = 0;
 	uint8_t modifiers;
 
@@ -644,13 +671,23 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 
 	/* clear temporary storage */
 	if (bit_test(sc->sc_loc_key_valid, 0) && id == sc->sc_id_loc_key[0]) {
-		BIT_FOREACH(sc->sc_ndata0, HKBD_NKEYCODE, i)
-			bit_clear(sc->sc_ndata, i);
+		for (i = 0; i < HKBD_NWORDS; i++)
+			sc->sc_ndata[i] &= ~sc->sc_ndata0[i];
 		bit_nclear(sc->sc_ndata0, 0, HKBD_NKEYCODE - 1);
 	}
-	BIT_FOREACH(sc->sc_ndata, HKBD_NKEYCODE, i)
-		if (id == sc->sc_id_loc_key[i])
-			bit_clear(sc->sc_ndata, i);
+	if (sc->sc_nkey_ids != 0) {
+		for (j = 0; j < sc->sc_nkey_ids; j++) {
+			if (sc->sc_key_ids[j] != id)
+				continue;
+			for (i = 0; i < HKBD_NWORDS; i++)
+				sc->sc_ndata[i] &= ~sc->sc_key_mask[j][i];
+			break;
+		}
+	} else {
+		BIT_FOREACH(sc->sc_ndata, HKBD_NKEYCODE, i)
+			if (id == sc->sc_id_loc_key[i])
+				bit_clear(sc->sc_ndata, i);
+	}
 
 	/* clear modifiers */
 	modifiers = 0;
@@ -667,37 +704,57 @@ hkbd_intr_callback(void *context, void *data, hid_size_t len)
 			modifiers |= MOD_FN;
 	}
 
-	BIT_FOREACH(sc->sc_loc_key_valid, HKBD_NKEYCODE, i) {
+	if (bit_test(sc->sc_loc_key_valid, 0) && id == sc->sc_id_loc_key[0]) {
+		struct hid_location tmp_loc = sc->sc_loc_key[0];
+		/* byte aligned 8-bit usage array is read directly */
+		bool aligned8 = tmp_loc.size == 8 && tmp_loc.pos % 8 == 0;
+		/* range check array size */
+		if (tmp_loc.count > HKBD_NKEYCODE)
+			tmp_loc.count = HKBD_NKEYCODE;
+		while (tmp_loc.count--) {
+			uint32_t key;
+
+			if (aligned8)
+				key = tmp_loc.pos / 8 < len ?
+				    buf[tmp_loc.pos / 8] : 0;
+			else
+				key = hid_get_udata(buf, len, &tmp_loc);
+			/* advance to next location */
+			tmp_loc.pos += tmp_loc.size;
+			if (key == KEY_ERROR) {
+				DPRINTF("KEY_ERROR\n");
+				memcpy(sc->sc_ndata0, sc->sc_odata0,
+				    bitstr_size(HKBD_NKEYCODE));
+				memcpy(sc->sc_ndata, sc->sc_odata,
+				    bitstr_size(HKBD_NKEYCODE));
+				return;	/* ignore */
+			}
+			if (modifiers & MOD_FN)
+				key = hkbd_apple_fn(key);
+			if (sc->sc_flags & HKBD_FLAG_APPLE_SWAP)
+				key = hkbd_apple_swap(key);
+			if (key == KEY_NONE || key >= HKBD_NKEYCODE)
+				continue;
+			/* set key in bitmap */
+			bit_set(sc->sc_ndata, key);
+			bit_set(sc->sc_ndata0, key);
+		}
+	}
+
+	/* copy runs of bitmap keys straight from report */
+	for (j = 0; j < sc->sc_nkey_runs; j++) {
+		if (id != sc->sc_key_runs[j].id)
+			continue;
+		for (bits = hid_field_get_udata(buf, len,
+		    &sc->sc_key_runs[j].field);
+		    bits != 0; bits &= bits - 1)
+			bit_set(sc->sc_ndata,
+			    sc->sc_key_runs[j].key + ffs(bits) - 1);
+	}
+
+	BIT_FOREACH(sc->sc_loc_key_slow, HKBD_NKEYCODE, i) {
 		if (id != sc->sc_id_loc_key[i]) {
 			continue;	/* invalid HID ID */
-		} else if (i == 0) {
-			struct hid_location tmp_loc = sc->sc_loc_key[0];
-			/* range check array size */
-			if (tmp_loc.count > HKBD_NKEYCODE)
-				tmp_loc.count = HKBD_NKEYCODE;
-			while (tmp_loc.count--) {
-				uint32_t key =
-				    hid_get_udata(buf, len, &tmp_loc);
-				/* advance to next location */
-				tmp_loc.pos += tmp_loc.size;
-				if (key == KEY_ERROR) {
-					DPRINTF("KEY_ERROR\n");
-					memcpy(sc->sc_ndata0, sc->sc_odata0,
-					    bitstr_size(HKBD_NKEYCODE));
-					memcpy(sc->sc_ndata, sc->sc_odata,
-					    bitstr_size(HKBD_NKEYCODE));
-					return;	/* ignore */
-				}
-				if (modifiers & MOD_FN)
-					key = hkbd_apple_fn(key);
-				if (sc->sc_flags & HKBD_FLAG_APPLE_SWAP)
-					key = hkbd_apple_swap(key);
-				if (key == KEY_NONE || key >= HKBD_NKEYCODE)
-					continue;
-				/* set key in bitmap */
-				bit_set(sc->sc_ndata, key);
-				bit_set(sc->sc_ndata0, key);
-			}
 		} else if (hid_get_data(buf, len, &sc->sc_loc_key[i])) {
 			uint32_t key = i;
 
@@ -745,6 +802,89 @@ hkbd_probe(device_t dev)
 	return (BUS_PROBE_DEFAULT);
 }
 
+/*
+ * Precompute per report ID key masks and runs of adjacent 1-bit variable
+ * keys used by hkbd_intr_callback() to process NKRO bitmaps word-wise.
+ */
+static void
+hkbd_build_key_maps(struct hkbd_softc *sc)
+{
+	struct hid_location *loc;
+	uint32_t key;
+	uint8_t id, j, n = 0;
+
+	memset(sc->sc_key_mask, 0, sizeof(sc->sc_key_mask));
+	for (key = 0; key < HKBD_NKEYCODE; key++) {
+		id = sc->sc_id_loc_key[key];
+		for (j = 0; j < n && sc->sc_key_ids[j] != id; j++)
+			;
+		if (j == n) {
+			if (n == HKBD_NKEYIDS) {
+				DPRINTFN(1, "Too many key report IDs\n");
+				n = 0;
+				break;
+			}
+			sc->sc_key_ids[n++] = id;
+		}
+		bit_set(sc->sc_key_mask[j], key);
+	}
+	sc->sc_nkey_ids = n;
+
+	n = 0;
+	bit_nclear(sc->sc_loc_key_slow, 0, HKBD_NKEYCODE - 1);
+	for (key = 1; key < HKBD_NKEYCODE; key++) {
+		if (!bit_test(sc->sc_loc_key_valid, key))
+			continue;
+		loc = &sc->sc_loc_key[key];
+		/* Apple FN and swap remap keycodes, keep per-key path */
+		if ((sc->sc_flags &
+		    (HKBD_FLAG_APPLE_FN | HKBD_FLAG_APPLE_SWAP)) != 0 ||
+		    key == KEY_ERROR || loc->size != 1 || loc->count > 1) {
+			bit_set(sc->sc_loc_key_slow, key);
+			continue;
+		}
+		if (n != 0 &&
+		    sc->sc_key_runs[n - 1].id == sc->sc_id_loc_key[key] &&
+		    sc->sc_key_runs[n - 1].key +
+		      sc->sc_key_runs[n - 1].field.loc.size == key &&
+		    sc->sc_key_runs[n - 1].field.loc.pos +
+		      sc->sc_key_runs[n - 1].field.loc.size == loc->pos &&
+		    sc->sc_key_runs[n - 1].field.loc.size < 32) {
+			sc->sc_key_runs[n - 1].field.loc.size++;
+		} else if (n < HKBD_NKEYRUNS) {
+			sc->sc_key_runs[n].field.loc = *loc;
+			sc->sc_key_runs[n].key = key;
+			sc->sc_key_runs[n].id = sc->sc_id_loc_key[key];
+			n++;
+		} else
+			bit_set(sc->sc_loc_key_slow, key);
+	}
+	sc->sc_nkey_runs = n;
+	/* Whole bytes and words of bitmap are extracted with plain loads */
+	for (j = 0; j < n; j++)
+		hid_field_init(&sc->sc_key_runs[j].field,
+		    &sc->sc_key_runs[j].field.loc);
+	DPRINTFN(1, "%d key runs, %d key report IDs\n", n, sc->sc_nkey_ids);
+}
+
+/*
+ * Use report descriptor index of hidbus unless built-in boot protocol
+ * descriptor is parsed. It saves full descriptor walk per each key usage.
+ */
+static int
+hkbd_locate(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
+    int32_t u, enum hid_kind k, uint8_t tlc_index, uint8_t index,
+    struct hid_location *loc, uint32_t *flags, uint8_t *id,
+    struct hid_absinfo *ai)
+{
+	if (ptr == hkbd_boot_desc)
+		return (hidbus_locate(ptr, len, u, k, tlc_index, index, loc,
+		    flags, id, ai));
+
+	return (hidbus_locate_item(sc->sc_dev, u, k, tlc_index, index, loc,
+	    flags, id, ai));
+}
+
 static void
 hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
     uint8_t tlc_index)
@@ -764,7 +904,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 	    hid_input, &sc->sc_kbd_id);
 
 	/* investigate if this is an Apple Keyboard */
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(HUP_CONSUMER, HUG_APPLE_EJECT),
 	    hid_input, tlc_index, 0, &sc->sc_loc_apple_eject, &flags,
 	    &sc->sc_id_apple_eject, NULL)) {
@@ -773,7 +913,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 			    HKBD_FLAG_APPLE_SWAP;
 		DPRINTFN(1, "Found Apple eject-key\n");
 	}
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(0xFFFF, 0x0003),
 	    hid_input, tlc_index, 0, &sc->sc_loc_apple_fn, &flags,
 	    &sc->sc_id_apple_fn, NULL)) {
@@ -783,7 +923,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 	}
 
 	/* figure out event buffer */
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(HUP_KEYBOARD, 0x00),
 	    hid_input, tlc_index, 0, &sc->sc_loc_key[0], &flags,
 	    &sc->sc_id_loc_key[0], NULL)) {
@@ -797,7 +937,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 
 	/* figure out the keys */
 	for (key = 1; key != HKBD_NKEYCODE; key++) {
-		if (hidbus_locate(ptr, len,
+		if (hkbd_locate(sc, ptr, len,
 		    HID_USAGE2(HUP_KEYBOARD, key),
 		    hid_input, tlc_index, 0, &sc->sc_loc_key[key], &flags,
 		    &sc->sc_id_loc_key[key], NULL)) {
@@ -809,7 +949,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 	}
 
 	/* figure out leds on keyboard */
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(HUP_LEDS, 0x01),
 	    hid_output, tlc_index, 0, &sc->sc_loc_numlock, &flags,
 	    &sc->sc_id_leds, NULL)) {
@@ -817,7 +957,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 			sc->sc_flags |= HKBD_FLAG_NUMLOCK;
 		DPRINTFN(1, "Found keyboard numlock\n");
 	}
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(HUP_LEDS, 0x02),
 	    hid_output, tlc_index, 0, &sc->sc_loc_capslock, &flags,
 	    &id, NULL)) {
@@ -827,7 +967,7 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 			sc->sc_flags |= HKBD_FLAG_CAPSLOCK;
 		DPRINTFN(1, "Found keyboard capslock\n");
 	}
-	if (hidbus_locate(ptr, len,
+	if (hkbd_locate(sc, ptr, len,
 	    HID_USAGE2(HUP_LEDS, 0x03),
 	    hid_output, tlc_index, 0, &sc->sc_loc_scrolllock, &flags,
 	    &id, NULL)) {
@@ -843,6 +983,8 @@ hkbd_parse_hid(struct hkbd_softc *sc, const uint8_t *ptr, uint32_t len,
 	    HKBD_FLAG_SCROLLLOCK)) != 0)
 		sc->sc_led_size = hid_report_size_1(ptr, len,
 		    hid_output, sc->sc_id_leds);
+
+	hkbd_build_key_maps(sc);
 }
 
 static int
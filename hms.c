@@ -142,10 +142,11 @@ struct hms_softc {
 	hid_size_t		isize;
 	uint32_t		drift_cnt;
 	uint32_t		drift_thresh;
+	int			rel_coalesce;	/* usecs */
 };
 
 static void
-hms_intr(void *context, void *buf, hid_size_t len)
+hms_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
 {
 	struct hidmap *hm = context;
 	struct hms_softc *sc = device_get_softc(hm->dev);
@@ -169,7 +170,7 @@ hms_intr(void *context, void *buf, hid_size_t len)
 		bcopy(buf, sc->last_ir, len);
 	}
 
-	hidmap_intr(context, buf, len);
+	hidmap_intr(context, buf, len, time);
 }
 
 static int
@@ -193,6 +194,26 @@ hms_final_cb(HIDMAP_CB_ARGS)
 	return (ENOSYS);
 }
 
+static int
+hms_sysctl_rel_coalesce(SYSCTL_HANDLER_ARGS)
+{
+	struct hms_softc *sc = arg1;
+	int error, value;
+
+	value = sc->rel_coalesce;
+	error = sysctl_handle_int(oidp, &value, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	if (value < 0 || value > 1000000)
+		return (EINVAL);
+
+	sc->rel_coalesce = value;
+	hidmap_set_rel_coalesce(&sc->hm, ustosbt(value));
+
+	return (0);
+}
+
 static void
 hms_identify(driver_t *driver, device_t parent)
 {
@@ -292,6 +313,23 @@ hms_attach(device_t dev)
 	if (error)
 		return (error);
 
+	/*
+	 * Optionally merge relative motion of high polling rate mice to
+	 * lower rate of evdev frames. Button changes flush it immediately.
+	 */
+	if (hidmap_test_cap(sc->caps, HMS_REL_X) ||
+	    hidmap_test_cap(sc->caps, HMS_REL_Y)) {
+		TUNABLE_INT_FETCH("hw.hid.hms.rel_coalesce", &sc->rel_coalesce);
+		if (sc->rel_coalesce < 0 || sc->rel_coalesce > 1000000)
+			sc->rel_coalesce = 0;
+		hidmap_set_rel_coalesce(&sc->hm, ustosbt(sc->rel_coalesce));
+		SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		    "rel_coalesce", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 0,
+		    hms_sysctl_rel_coalesce, "I",
+		    "relative motion coalescing interval, usecs (0 - off)");
+	}
+
 	/* Count number of input usages of variable type mapped to buttons */
 	for (hi = sc->hm.hid_items;
 	     hi < sc->hm.hid_items + sc->hm.nhid_items;
@@ -51,6 +51,7 @@ __FBSDID("$FreeBSD$");
 #include "hidquirk.h"
 
 #include "hconf.h"
+#include "hidmt.h"
 
 #define	HID_DEBUG_VAR	hmt_debug
 #include "hid_debug.h"
@@ -184,11 +185,14 @@ struct hmt_softc {
 	enum hmt_type		type;
 
 	struct hid_absinfo	ai[HMT_N_USAGES];
-	struct hid_location	locs[MAX_MT_SLOTS][HMT_N_USAGES];
-	struct hid_location	cont_count_loc;
-	struct hid_location	btn_loc[HMT_BTN_MAX];
-	struct hid_location	int_btn_loc;
-	struct hid_location	scan_time_loc;
+	/* Per-contact input fields in extraction program order */
+	struct hid_field	fields[MAX_MT_SLOTS][HMT_N_USAGES];
+	uint8_t			extract[HMT_N_USAGES];	/* Field to usage */
+	uint8_t			nextract;
+	struct hid_field	cont_count_fld;
+	struct hid_field	btn_fld[HMT_BTN_MAX];
+	struct hid_field	int_btn_fld;
+	struct hid_field	scan_time_fld;
 	int32_t			scan_time_max;
 	int32_t			scan_time;
 	int32_t			timestamp;
@@ -196,8 +200,12 @@ struct hmt_softc {
 	bool			prev_touch;
 
 	struct evdev_dev	*evdev;
+	struct hidmt		mt;
 
-	uint32_t		slot_data[HMT_N_USAGES];
+	/* Hybrid mode reassembly buffer */
+	uint32_t		frame_data[MAX_MT_SLOTS][HMT_N_USAGES];
+	uint32_t		frame_nconts;
+	uint32_t		frame_scan_time;
 	uint8_t			caps[howmany(HMT_N_USAGES, 8)];
 	uint8_t			buttons[howmany(HMT_BTN_MAX, 8)];
 	uint32_t		nconts_per_report;
@@ -223,8 +231,9 @@ struct hmt_softc {
 	for ((usage) = 0; (usage) < HMT_N_USAGES; ++(usage))	\
 		if (isset((caps), (usage)))
 
-static enum hmt_type hmt_hid_parse(struct hmt_softc *, const void *,
-    hid_size_t, uint32_t, uint8_t);
+static enum hmt_type hmt_hid_parse(struct hmt_softc *, device_t,
+    const void *, hid_size_t, uint32_t, uint8_t);
+static void hmt_compile(struct hmt_softc *, size_t);
 static int hmt_set_input_mode(struct hmt_softc *, enum hconf_input_mode);
 
 static hid_intr_t	hmt_intr;
@@ -266,6 +275,18 @@ hmt_ev_open(struct evdev_dev *evdev)
 	return (hidbus_intr_start(dev));
 }
 
+static void
+hmt_init_feature_req(struct hid_request *req, uint8_t *buf, hid_size_t len,
+    uint8_t id)
+{
+	*req = (struct hid_request) {
+		.data = buf,
+		.len = len,
+		.type = HID_FEATURE_REPORT,
+		.id = id,
+	};
+}
+
 static int
 hmt_probe(device_t dev)
 {
@@ -287,7 +308,7 @@ hmt_probe(device_t dev)
 
 	/* Check if report descriptor belongs to a HID multitouch device */
 	if (sc->type == HMT_TYPE_UNKNOWN)
-		sc->type = hmt_hid_parse(sc, d_ptr, d_len,
+		sc->type = hmt_hid_parse(sc, dev, d_ptr, d_len,
 		    hidbus_get_usage(dev), hidbus_get_index(dev));
 	if (sc->type == HMT_TYPE_UNSUPPORTED)
 		return (ENXIO);
@@ -306,8 +327,10 @@ hmt_attach(device_t dev)
 	void *d_ptr;
 	uint8_t *fbuf = NULL;
 	hid_size_t d_len, fsize;
+	struct hid_request reqs[3], *cont_req = NULL, *btn_req = NULL;
 	uint32_t cont_count_max;
 	int nbuttons, btn;
+	int nreqs = 0;
 	size_t i;
 	int err;
 
@@ -322,14 +345,45 @@ hmt_attach(device_t dev)
 
 	fsize = hid_report_size(d_ptr, d_len, hid_feature, NULL);
 	if (fsize != 0)
-		fbuf = malloc(fsize, M_TEMP, M_WAITOK | M_ZERO);
+		fbuf = malloc(fsize * nitems(reqs), M_TEMP, M_WAITOK | M_ZERO);
 
-	/* Fetch and parse "Contact count maximum" feature report */
+	/*
+	 * Fetch "Contact count maximum", "Button type" and THQA certificate
+	 * feature reports back to back rather than one round trip at a time.
+	 */
 	if (sc->cont_max_rlen > 1) {
-		err = hid_get_report(dev, fbuf, sc->cont_max_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->cont_max_rid);
-		if (err == 0) {
-			cont_count_max = hid_get_udata(fbuf + 1,
+		cont_req = reqs + nreqs;
+		hmt_init_feature_req(cont_req, fbuf + nreqs * fsize,
+		    sc->cont_max_rlen, sc->cont_max_rid);
+		nreqs++;
+	} else
+		DPRINTF("Feature report %hhu size invalid: %u\n",
+		    sc->cont_max_rid, sc->cont_max_rlen);
+	if (sc->btn_type_rlen > 1) {
+		if (cont_req != NULL && sc->btn_type_rid == sc->cont_max_rid)
+			btn_req = cont_req;
+		else {
+			btn_req = reqs + nreqs;
+			hmt_init_feature_req(btn_req, fbuf + nreqs * fsize,
+			    sc->btn_type_rlen, sc->btn_type_rid);
+			nreqs++;
+		}
+	}
+	/* Fetch THQA certificate to enable some devices like WaveShare */
+	if (sc->thqa_cert_rlen > 1 && sc->thqa_cert_rid != sc->cont_max_rid) {
+		hmt_init_feature_req(reqs + nreqs, fbuf + nreqs * fsize,
+		    sc->thqa_cert_rlen, sc->thqa_cert_rid);
+		nreqs++;
+	}
+
+	if (nreqs != 0)
+		(void)hidbus_submit_wait(dev, reqs, nreqs);
+
+	/* Parse "Contact count maximum" feature report */
+	if (cont_req != NULL) {
+		if (cont_req->error == 0) {
+			cont_count_max = hid_get_udata(
+			    (uint8_t *)cont_req->data + 1,
 			    sc->cont_max_rlen - 1, &sc->cont_max_loc);
 			/*
 			 * Feature report is a primary source of
@@ -338,30 +392,19 @@ hmt_attach(device_t dev)
 			if (cont_count_max > 0)
 				sc->ai[HMT_SLOT].max = cont_count_max - 1;
 		} else
-			DPRINTF("hid_get_report error=%d\n", err);
-	} else
-		DPRINTF("Feature report %hhu size invalid: %u\n",
-		    sc->cont_max_rid, sc->cont_max_rlen);
-
-	/* Fetch and parse "Button type" feature report */
-	if (sc->btn_type_rlen > 1 && sc->btn_type_rid != sc->cont_max_rid) {
-		bzero(fbuf, fsize);
-		err = hid_get_report(dev, fbuf, sc->btn_type_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->btn_type_rid);
+			DPRINTF("hid_get_report error=%d\n", cont_req->error);
 	}
-	if (sc->btn_type_rlen > 1) {
-		if (err == 0)
-			sc->is_clickpad = hid_get_udata(fbuf + 1,
+
+	/* Parse "Button type" feature report */
+	if (btn_req != NULL) {
+		if (btn_req->error == 0)
+			sc->is_clickpad = hid_get_udata(
+			    (uint8_t *)btn_req->data + 1,
 			    sc->btn_type_rlen - 1, &sc->btn_type_loc) == 0;
 		else
-			DPRINTF("hid_get_report error=%d\n", err);
+			DPRINTF("hid_get_report error=%d\n", btn_req->error);
 	}
 
-	/* Fetch THQA certificate to enable some devices like WaveShare */
-	if (sc->thqa_cert_rlen > 1 && sc->thqa_cert_rid != sc->cont_max_rid)
-		(void)hid_get_report(dev, fbuf, sc->thqa_cert_rlen, NULL,
-		    HID_FEATURE_REPORT, sc->thqa_cert_rid);
-
 	free(fbuf, M_TEMP);
 
 	/* Switch touchpad in to absolute multitouch mode */
@@ -425,10 +468,15 @@ hmt_attach(device_t dev)
 			}
 		}
 	}
+	hidmt_init(&sc->mt, sc->evdev, sc->iichid_sampling);
 	HMT_FOREACH_USAGE(sc->caps, i) {
-		if (hmt_hid_map[i].code != HMT_NO_CODE)
-			evdev_support_abs(sc->evdev, hmt_hid_map[i].code, 0,
-			    sc->ai[i].min, sc->ai[i].max, 0, 0, sc->ai[i].res);
+		if (hmt_hid_map[i].code == HMT_NO_CODE)
+			continue;
+		evdev_support_abs(sc->evdev, hmt_hid_map[i].code, 0,
+		    sc->ai[i].min, sc->ai[i].max, 0, 0, sc->ai[i].res);
+		/* ABS_MT_SLOT is pushed by hidmt_push_contact() on demand */
+		if (i != HMT_SLOT)
+			hidmt_add_prop(&sc->mt, i, hmt_hid_map[i].code);
 	}
 
 	err = evdev_register_mtx(sc->evdev, hidbus_get_lock(sc->dev));
@@ -466,21 +514,98 @@ hmt_detach(device_t dev)
 	return (0);
 }
 
+/*
+ * Report all contacts collected in the reassembly buffer as single MT frame.
+ */
 static void
-hmt_intr(void *context, void *buf, hid_size_t len)
+hmt_sync_frame(struct hmt_softc *sc)
 {
-	struct hmt_softc *sc = context;
+#ifdef HID_DEBUG
 	size_t usage;
-	uint32_t *slot_data = sc->slot_data;
-	uint32_t cont, btn;
-	uint32_t cont_count;
+#endif
+	uint32_t *slot_data;
+	uint32_t cont;
 	uint32_t width;
 	uint32_t height;
+	int32_t slot;
+	int32_t delta;
+
+	for (cont = 0; cont < sc->frame_nconts; cont++) {
+		slot_data = sc->frame_data[cont];
+		slot = evdev_get_mt_slot_by_tracking_id(sc->evdev,
+		    slot_data[HMT_CONTACTID]);
+
+#ifdef HID_DEBUG
+		DPRINTFN(6, "cont%01x: data = ", cont);
+		if (hmt_debug >= 6) {
+			HMT_FOREACH_USAGE(sc->caps, usage) {
+				if (hmt_hid_map[usage].usage != HMT_NO_USAGE)
+					printf("%04x ", slot_data[usage]);
+			}
+			printf("slot = %d\n", (int)slot);
+		}
+#endif
+
+		if (slot == -1) {
+			DPRINTF("Slot overflow for contact_id %u\n",
+			    (unsigned)slot_data[HMT_CONTACTID]);
+			continue;
+		}
+
+		if (slot_data[HMT_TIP_SWITCH] != 0 &&
+		    !(isset(sc->caps, HMT_CONFIDENCE) &&
+		      slot_data[HMT_CONFIDENCE] == 0)) {
+			/* This finger is in proximity of the sensor */
+			sc->touch = true;
+			slot_data[HMT_SLOT] = slot;
+			slot_data[HMT_IN_RANGE] = !slot_data[HMT_IN_RANGE];
+			/* Divided by two to match visual scale of touch */
+			width = slot_data[HMT_WIDTH] >> 1;
+			height = slot_data[HMT_HEIGHT] >> 1;
+			slot_data[HMT_ORIENTATION] = width > height;
+			slot_data[HMT_MAJOR] = MAX(width, height);
+			slot_data[HMT_MINOR] = MIN(width, height);
+
+			hidmt_push_contact(&sc->mt, slot, slot_data);
+		} else
+			hidmt_release_contact(&sc->mt, slot);
+	}
+	sc->frame_nconts = 0;
+
+	if (sc->do_timestamps) {
+		/* HUD_SCAN_TIME is measured in 100us, convert to us. */
+		if (sc->prev_touch) {
+			delta = sc->frame_scan_time - sc->scan_time;
+			if (delta < 0)
+				delta += sc->scan_time_max;
+		} else
+			delta = 0;
+		sc->scan_time = sc->frame_scan_time;
+		sc->timestamp += delta * 100;
+		evdev_push_msc(sc->evdev, MSC_TIMESTAMP, sc->timestamp);
+		sc->prev_touch = sc->touch;
+		sc->touch = false;
+		if (!sc->prev_touch)
+			sc->timestamp = 0;
+	}
+
+	hidmt_end_frame(&sc->mt);
+	evdev_sync(sc->evdev);
+}
+
+static void
+hmt_intr(void *context, void *buf, hid_size_t len, sbintime_t time)
+{
+	struct hmt_softc *sc = context;
+#ifdef HID_DEBUG
+	size_t usage;
+#endif
+	uint32_t *slot_data;
+	uint32_t cont, btn, i;
+	uint32_t cont_count;
 	uint32_t int_btn = 0;
 	uint32_t left_btn = 0;
-	int32_t slot;
 	uint32_t scan_time;
-	int32_t delta;
 	uint8_t id;
 
 	mtx_assert(hidbus_get_lock(sc->dev), MA_OWNED);
@@ -494,10 +619,9 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	if (sc->iichid_sampling && len == 0) {
 		sc->prev_touch = false;
 		sc->timestamp = 0;
-		for (slot = 0; slot <= sc->ai[HMT_SLOT].max; slot++) {
-			evdev_push_abs(sc->evdev, ABS_MT_SLOT, slot);
-			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, -1);
-		}
+		sc->nconts_todo = 0;
+		sc->frame_nconts = 0;
+		hidmt_release_all(&sc->mt, sc->ai[HMT_SLOT].max + 1);
 		evdev_sync(sc->evdev);
 		return;
 	}
@@ -524,7 +648,8 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	 * report with contactid=0 but contactids are zero-based, find
 	 * contactcount first.
 	 */
-	cont_count = hid_get_udata(buf, len, &sc->cont_count_loc);
+	cont_count = hid_field_get_udata(buf, len, &sc->cont_count_fld);
+	scan_time = hid_field_get_udata(buf, len, &sc->scan_time_fld);
 	/*
 	 * "In Hybrid mode, the number of contacts that can be reported in one
 	 * report is less than the maximum number of contacts that the device
@@ -538,7 +663,21 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	 * value in the first report should reflect the total number of
 	 * contacts that are being delivered in the hybrid reports. The other
 	 * serial reports should have a contact count of zero (0)."
+	 *
+	 * All serial reports of the frame carry the same scan time. Contacts
+	 * are collected in reassembly buffer and reported to evdev at once
+	 * when the last serial report arrives. If the next frame starts
+	 * before that, report what has been collected so far.
 	 */
+	if (sc->nconts_todo != 0 &&
+	    (cont_count != 0 || scan_time != sc->frame_scan_time)) {
+		DPRINTF("Incomplete frame, %u contacts missing\n",
+		    (unsigned)sc->nconts_todo);
+		sc->nconts_todo = 0;
+		hmt_sync_frame(sc);
+	}
+	if (sc->nconts_todo == 0)
+		sc->frame_scan_time = scan_time;
 	if (cont_count != 0)
 		sc->nconts_todo = cont_count;
 
@@ -556,102 +695,46 @@ hmt_intr(void *context, void *buf, hid_size_t len)
 	/* Find the number of contacts reported in current report */
 	cont_count = MIN(sc->nconts_todo, sc->nconts_per_report);
 
-	/* Use protocol Type B for reporting events */
+	/* Buffer contacts till the frame is complete */
 	for (cont = 0; cont < cont_count; cont++) {
-		bzero(slot_data, sizeof(sc->slot_data));
-		HMT_FOREACH_USAGE(sc->caps, usage) {
-			if (sc->locs[cont][usage].size > 0)
-				slot_data[usage] = hid_get_udata(
-				    buf, len, &sc->locs[cont][usage]);
-		}
-
-		slot = evdev_get_mt_slot_by_tracking_id(sc->evdev,
-		    slot_data[HMT_CONTACTID]);
-
-#ifdef HID_DEBUG
-		DPRINTFN(6, "cont%01x: data = ", cont);
-		if (hmt_debug >= 6) {
-			HMT_FOREACH_USAGE(sc->caps, usage) {
-				if (hmt_hid_map[usage].usage != HMT_NO_USAGE)
-					printf("%04x ", slot_data[usage]);
-			}
-			printf("slot = %d\n", (int)slot);
-		}
-#endif
-
-		if (slot == -1) {
-			DPRINTF("Slot overflow for contact_id %u\n",
-			    (unsigned)slot_data[HMT_CONTACTID]);
-			continue;
-		}
-
-		if (slot_data[HMT_TIP_SWITCH] != 0 &&
-		    !(isset(sc->caps, HMT_CONFIDENCE) &&
-		      slot_data[HMT_CONFIDENCE] == 0)) {
-			/* This finger is in proximity of the sensor */
-			sc->touch = true;
-			slot_data[HMT_SLOT] = slot;
-			slot_data[HMT_IN_RANGE] = !slot_data[HMT_IN_RANGE];
-			/* Divided by two to match visual scale of touch */
-			width = slot_data[HMT_WIDTH] >> 1;
-			height = slot_data[HMT_HEIGHT] >> 1;
-			slot_data[HMT_ORIENTATION] = width > height;
-			slot_data[HMT_MAJOR] = MAX(width, height);
-			slot_data[HMT_MINOR] = MIN(width, height);
-
-			HMT_FOREACH_USAGE(sc->caps, usage)
-				if (hmt_hid_map[usage].code != HMT_NO_CODE)
-					evdev_push_abs(sc->evdev,
-					    hmt_hid_map[usage].code,
-					    slot_data[usage]);
-		} else {
-			evdev_push_abs(sc->evdev, ABS_MT_SLOT, slot);
-			evdev_push_abs(sc->evdev, ABS_MT_TRACKING_ID, -1);
+		if (sc->frame_nconts >= MAX_MT_SLOTS) {
+			DPRINTF("Reassembly buffer overflow\n");
+			break;
 		}
+		slot_data = sc->frame_data[sc->frame_nconts++];
+		bzero(slot_data, sizeof(sc->frame_data[0]));
+		for (i = 0; i < sc->nextract; i++)
+			slot_data[sc->extract[i]] = hid_field_get_udata(
+			    buf, len, &sc->fields[cont][i]);
 	}
 
 	sc->nconts_todo -= cont_count;
-	if (sc->do_timestamps && sc->nconts_todo == 0) {
-		/* HUD_SCAN_TIME is measured in 100us, convert to us. */
-		scan_time = hid_get_udata(buf, len, &sc->scan_time_loc);
-		if (sc->prev_touch) {
-			delta = scan_time - sc->scan_time;
-			if (delta < 0)
-				delta += sc->scan_time_max;
-		} else
-			delta = 0;
-		sc->scan_time = scan_time;
-		sc->timestamp += delta * 100;
-		evdev_push_msc(sc->evdev, MSC_TIMESTAMP, sc->timestamp);
-		sc->prev_touch = sc->touch;
-		sc->touch = false;
-		if (!sc->prev_touch)
-			sc->timestamp = 0;
-	}
-	if (sc->nconts_todo == 0) {
-		/* Report both the click and external left btns as BTN_LEFT */
-		if (sc->has_int_button)
-			int_btn = hid_get_data(buf, len, &sc->int_btn_loc);
-		if (sc->max_button != 0 && isset(sc->buttons, 0))
-			left_btn = hid_get_data(buf, len, &sc->btn_loc[0]);
-		if (sc->has_int_button ||
-		    (sc->max_button != 0 && isset(sc->buttons, 0)))
-			evdev_push_key(sc->evdev, BTN_LEFT,
-			    (int_btn != 0) | (left_btn != 0));
-		for (btn = 1; btn < sc->max_button; ++btn) {
-			if (isset(sc->buttons, btn))
-				evdev_push_key(sc->evdev, BTN_MOUSE + btn,
-				    hid_get_data(buf,
-						 len,
-						 &sc->btn_loc[btn]) != 0);
-		}
-		evdev_sync(sc->evdev);
+	if (sc->nconts_todo != 0)
+		return;
+
+	/* Report both the click and external left btns as BTN_LEFT */
+	if (sc->has_int_button)
+		int_btn = hid_field_get_data(buf, len, &sc->int_btn_fld);
+	if (sc->max_button != 0 && isset(sc->buttons, 0))
+		left_btn = hid_field_get_data(buf, len, &sc->btn_fld[0]);
+	if (sc->has_int_button ||
+	    (sc->max_button != 0 && isset(sc->buttons, 0)))
+		evdev_push_key(sc->evdev, BTN_LEFT,
+		    (int_btn != 0) | (left_btn != 0));
+	for (btn = 1; btn < sc->max_button; ++btn) {
+		if (isset(sc->buttons, btn))
+			evdev_push_key(sc->evdev, BTN_MOUSE + btn,
+			    hid_field_get_data(buf,
+					 len,
+					 &sc->btn_fld[btn]) != 0);
 	}
+
+	hmt_sync_frame(sc);
 }
 
 static enum hmt_type
-hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
-    uint32_t tlc_usage, uint8_t tlc_index)
+hmt_hid_parse(struct hmt_softc *sc, device_t dev, const void *d_ptr,
+    hid_size_t d_len, uint32_t tlc_usage, uint8_t tlc_index)
 {
 	struct hid_absinfo ai;
 	struct hid_item hi;
@@ -698,7 +781,7 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	}
 
 	/* Parse features for mandatory maximum contact count usage */
-	if (!hidbus_locate(d_ptr, d_len,
+	if (!hidbus_locate_item(dev,
 	    HID_USAGE2(HUP_DIGITIZERS, HUD_CONTACT_MAX), hid_feature,
 	    tlc_index, 0, &sc->cont_max_loc, &flags, &sc->cont_max_rid, &ai) ||
 	    (flags & (HIO_VARIABLE | HIO_RELATIVE)) != HIO_VARIABLE)
@@ -707,14 +790,14 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	cont_count_max = ai.max;
 
 	/* Parse features for button type usage */
-	if (hidbus_locate(d_ptr, d_len,
+	if (hidbus_locate_item(dev,
 	    HID_USAGE2(HUP_DIGITIZERS, HUD_BUTTON_TYPE), hid_feature,
 	    tlc_index, 0, &sc->btn_type_loc, &flags, &sc->btn_type_rid, NULL)
 	    && (flags & (HIO_VARIABLE | HIO_RELATIVE)) != HIO_VARIABLE)
 		sc->btn_type_rid = 0;
 
 	/* Parse features for THQA certificate report ID */
-	hidbus_locate(d_ptr, d_len, HID_USAGE2(HUP_MICROSOFT, HUMS_THQA_CERT),
+	hidbus_locate_item(dev, HID_USAGE2(HUP_MICROSOFT, HUMS_THQA_CERT),
 	    hid_feature, tlc_index, 0, NULL, NULL, &sc->thqa_cert_rid, NULL);
 
 	/* Parse input for other parameters */
@@ -745,7 +828,7 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			if (hi.collevel == 1 && left_btn == 2 &&
 			    hi.usage == HID_USAGE2(HUP_BUTTON, 1)) {
 				has_int_button = true;
-				sc->int_btn_loc = hi.loc;
+				hid_field_init(&sc->int_btn_fld, &hi.loc);
 				break;
 			}
 			if (hi.collevel == 1 &&
@@ -753,7 +836,7 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			    hi.usage <= HID_USAGE2(HUP_BUTTON, HMT_BTN_MAX)) {
 				btn = (hi.usage & 0xFFFF) - left_btn;
 				setbit(sc->buttons, btn);
-				sc->btn_loc[btn] = hi.loc;
+				hid_field_init(&sc->btn_fld[btn], &hi.loc);
 				if (btn >= sc->max_button)
 					sc->max_button = btn + 1;
 				break;
@@ -761,14 +844,14 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 			if (hi.collevel == 1 && hi.usage ==
 			    HID_USAGE2(HUP_DIGITIZERS, HUD_CONTACTCOUNT)) {
 				cont_count_found = true;
-				sc->cont_count_loc = hi.loc;
+				hid_field_init(&sc->cont_count_fld, &hi.loc);
 				break;
 			}
 			/* Scan time is required but clobbered by evdev */
 			if (hi.collevel == 1 && hi.usage ==
 			    HID_USAGE2(HUP_DIGITIZERS, HUD_SCAN_TIME)) {
 				scan_time_found = true;
-				sc->scan_time_loc = hi.loc;
+				hid_field_init(&sc->scan_time_fld, &hi.loc);
 				sc->scan_time_max = hi.logical_maximum;
 				break;
 			}
@@ -788,9 +871,10 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 					 * events. So don`t stop search if we
 					 * already have HUG_X mapping done.
 					 */
-					if (sc->locs[cont][i].size)
+					if (sc->fields[cont][i].loc.size)
 						continue;
-					sc->locs[cont][i] = hi.loc;
+					hid_field_init(&sc->fields[cont][i],
+					    &hi.loc);
 					/*
 					 * Hid parser returns valid logical and
 					 * physical sizes for first finger only
@@ -847,6 +931,8 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 		sc->ai[HMT_ORIENTATION].max = 1;
 	}
 
+	hmt_compile(sc, cont);
+
 	sc->cont_max_rlen = hid_report_size_1(d_ptr, d_len, hid_feature,
 	    sc->cont_max_rid);
 	if (sc->btn_type_rid > 0)
@@ -863,6 +949,27 @@ hmt_hid_parse(struct hmt_softc *sc, const void *d_ptr, hid_size_t d_len,
 	return (type);
 }
 
+/*
+ * Build per-contact extraction program over usages present in the report
+ * and pack contact fields accordingly.
+ */
+static void
+hmt_compile(struct hmt_softc *sc, size_t nconts)
+{
+	size_t cont, usage;
+
+	sc->nextract = 0;
+	HMT_FOREACH_USAGE(sc->caps, usage) {
+		if (hmt_hid_map[usage].usage != HMT_NO_USAGE) {
+			/* Packing is done in place as nextract <= usage */
+			for (cont = 0; cont < nconts; cont++)
+				sc->fields[cont][sc->nextract] =
+				    sc->fields[cont][usage];
+			sc->extract[sc->nextract++] = usage;
+		}
+	}
+}
+
 static int
 hmt_set_input_mode(struct hmt_softc *sc, enum hconf_input_mode mode)
 {
@@ -915,6 +1022,7 @@ DRIVER_MODULE(hmt, hidbus, hmt_driver, hmt_devclass, NULL, 0);
 MODULE_DEPEND(hmt, hidbus, 1, 1, 1);
 MODULE_DEPEND(hmt, hid, 1, 1, 1);
 MODULE_DEPEND(hmt, hconf, 1, 1, 1);
+MODULE_DEPEND(hmt, hidmt, 1, 1, 1);
 MODULE_DEPEND(hmt, evdev, 1, 1, 1);
 MODULE_VERSION(hmt, 1);
 HID_PNP_INFO(hmt_devs);
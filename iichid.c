@@ -30,6 +30,7 @@ __FBSDID("$FreeBSD$");
 #include <sys/param.h>
 #include <sys/bus.h>
 #include <sys/callout.h>
+#include <sys/counter.h>
 #include <sys/endian.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
@@ -104,9 +105,13 @@ enum {
  * callout and, thereby, disable further report requests. Do not set the
  * sampling_rate_fast value too high as it may result in periodical lags of
  * cursor motion.
+ * Set dev.iichid.<unit>.sampling_adaptive to 1 to track the interval between
+ * reports the device actually delivers and to sample slightly faster than
+ * that cadence while active, decaying toward sampling_rate_slow when idle.
  */
 #define	IICHID_SAMPLING_RATE_FAST	60
 #define	IICHID_SAMPLING_RATE_SLOW	10
+#define	IICHID_SAMPLING_RATE_MAX	250	/* Adaptive mode upper limit */
 #define	IICHID_SAMPLING_HYSTERESIS	1
 
 /* 5.1.1 - HID Descriptor Format */
@@ -139,6 +144,28 @@ enum iichid_powerstate_how {
 	IICHID_PS_RESUME,
 };
 
+struct iichid_softc;
+
+/*
+ * Worker shared by all iichid devices attached to the same iicbus. Devices
+ * with pending input reports are queued in arrival order and read back to
+ * back within single bus ownership period.
+ */
+struct iichid_worker {
+	device_t		bus;		/* Parent iicbus */
+	u_int			refs;		/* iichid_worker_lock */
+	struct taskqueue	*taskqueue;
+	struct task		task;
+	struct mtx		mtx;
+	STAILQ_HEAD(, iichid_softc) pending;	/* mtx */
+	LIST_ENTRY(iichid_worker) link;		/* iichid_worker_lock */
+};
+
+static LIST_HEAD(, iichid_worker) iichid_workers =
+    LIST_HEAD_INITIALIZER(iichid_workers);
+static struct sx iichid_worker_lock;
+SX_SYSINIT(iichid_worker_lock, &iichid_worker_lock, "iichid workers");
+
 struct iichid_softc {
 	device_t		dev;
 
@@ -155,30 +182,57 @@ struct iichid_softc {
 	struct mtx		*intr_mtx;
 	uint8_t			*intr_buf;
 	iichid_size_t		intr_bufsize;
+	uint8_t			*intr_xfer;	/* Length header + intr_buf */
+	bool			single_read;
 
 	int			irq_rid;
 	struct resource		*irq_res;
 	void			*irq_cookie;
+	bool			intr_direct;	/* Fetch reports in ithread */
+	sbintime_t		intr_time;	/* Set by interrupt filter */
+	sbintime_t		intr_latency;	/* intr_mtx */
+	sbintime_t		resume_time;	/* intr_mtx */
+	u_int			resume_latency;	/* usec, intr_mtx */
+
+	/* Statistics */
+	counter_u64_t		stat_reports;
+	counter_u64_t		stat_empty;
+	counter_u64_t		stat_errors;
+	counter_u64_t		stat_latency[HID_LATENCY_NBUCKETS];
 
 #ifdef IICHID_SAMPLING
 	int			sampling_rate_slow;
 	int			sampling_rate_fast;
 	int			sampling_hysteresis;
 	int			missing_samples;
+	bool			sampling_adaptive;
+	sbintime_t		sampling_period;	/* intr_mtx */
+	sbintime_t		report_interval;	/* intr_mtx */
+	sbintime_t		last_report;		/* intr_mtx */
 	struct timeout_task	periodic_task;
 	bool			callout_setup;
 #endif
 
-	struct taskqueue	*taskqueue;
-	struct task		event_task;
+	struct iichid_worker	*worker;
+	struct taskqueue	*taskqueue;	/* Shared with worker */
+	STAILQ_ENTRY(iichid_softc) pending_link;	/* worker mtx */
+	STAILQ_ENTRY(iichid_softc) batch_link;		/* worker task */
+	bool			pending;		/* worker mtx */
+	iichid_size_t		intr_actual;	/* Worker batch result */
+	int			intr_error;	/* Worker batch result */
 	struct task		power_task;
+	struct task		req_task;
+	STAILQ_HEAD(, hid_request) req_queue;	/* intr_mtx */
 
 	bool			open;		/* intr_mtx */
 	bool			suspend;	/* iicbus lock */
 	bool			power_on;	/* iicbus lock */
+	bool			verify_desc;	/* iicbus lock */
+	bool			stale;		/* iicbus lock, replaced */
 };
 
 #ifdef IICHID_SAMPLING
+static void	iichid_sampling_update(struct iichid_softc *, bool);
 static int	iichid_setup_callout(struct iichid_softc *);
 static int	iichid_reset_callout(struct iichid_softc *);
 static void	iichid_teardown_callout(struct iichid_softc *);
@@ -372,6 +426,55 @@ iichid_cmd_read(struct iichid_softc* sc, void *buf, iichid_size_t maxlen,
 	return (error);
 }
 
+/*
+ * Fetch length header and the longest input report declared in report
+ * descriptor within single I2C transaction. DEVICE pads shorter reports so
+ * the excess bytes are simply dropped. That saves one bus round trip per
+ * report compared to iichid_cmd_read() at cost of a few extra clocked bytes.
+ */
+static int
+iichid_cmd_read_single(struct iichid_softc* sc, iichid_size_t *actual_len)
+{
+	struct iic_msg msgs[] = {
+	    { sc->addr, IIC_M_RD, sc->intr_bufsize + 2, sc->intr_xfer },
+	};
+	uint16_t actlen;
+	int error;
+
+	error = iicbus_transfer(sc->dev, msgs, nitems(msgs));
+	if (error != 0)
+		return (error);
+
+	actlen = le16dec(sc->intr_xfer);
+	if (actlen <= 2 || actlen == 0xFFFF)
+		actlen = 0;
+	else {
+		actlen -= 2;
+		if (actlen > sc->intr_bufsize) {
+			DPRINTF(sc, "input report too big. requested=%d "
+			    "received=%d\n", sc->intr_bufsize, actlen);
+			actlen = sc->intr_bufsize;
+		}
+	}
+	*actual_len = actlen;
+
+	DPRINTFN(sc, 5, "%*D - %*D\n",
+	    2, sc->intr_xfer, " ", actlen, sc->intr_buf, " ");
+
+	return (0);
+}
+
+static int
+iichid_cmd_read_intr(struct iichid_softc* sc, iichid_size_t maxlen,
+    iichid_size_t *actual_len)
+{
+	/* Header-only reads are used to acknowledge interrupts. */
+	if (sc->single_read && maxlen != 0)
+		return (iichid_cmd_read_single(sc, actual_len));
+
+	return (iichid_cmd_read(sc, sc->intr_buf, maxlen, actual_len));
+}
+
 static int
 iichid_cmd_write(struct iichid_softc *sc, const void *buf, iichid_size_t len)
 {
@@ -579,23 +682,60 @@ iichid_cmd_set_report(struct iichid_softc* sc, const void *buf,
 	return (iicbus_transfer(sc->dev, msgs, nitems(msgs)));
 }
 
+/*
+ * Track moving average and histogram of delay between hardware interrupt and
+ * completion of input report processing by hidbus children, which includes
+ * evdev_sync(), to compare ithread and taskqueue paths.
+ */
 static void
-iichid_event_task(void *context, int pending)
+iichid_update_latency(struct iichid_softc *sc)
 {
-	struct iichid_softc *sc = context;
-	device_t parent = device_get_parent(sc->dev);
-	iichid_size_t maxlen, actual = 0;
+	sbintime_t delta;
+
+	mtx_assert(sc->intr_mtx, MA_OWNED);
+
+	/* First input report processed since resume */
+	if (sc->resume_time != 0) {
+		sc->resume_latency = sbttous(sbinuptime() - sc->resume_time);
+		sc->resume_time = 0;
+	}
+
+	if (sc->intr_time == 0)
+		return;
+
+	delta = sbinuptime() - sc->intr_time;
+	sc->intr_time = 0;
+	sc->intr_latency += (delta - sc->intr_latency) / 8;
+	hid_latency_record(sc->stat_latency, delta);
+}
+
+/*
+ * Input report timestamp. Use time of hardware interrupt if it is known and
+ * time of the report read completion otherwise, e.g. in sampling mode.
+ */
+static sbintime_t
+iichid_report_time(struct iichid_softc *sc)
+{
+
+	return (sc->intr_time != 0 ? sc->intr_time : sbinuptime());
+}
+
+/*
+ * Deliver input report fetched by the worker and rearm sampling.
+ * fetched is false if the worker failed to acquire the bus.
+ */
+static void
+iichid_event_done(struct iichid_softc *sc, bool fetched)
+{
+	iichid_size_t actual = sc->intr_actual;
 	bool locked = false;
-	int error;
 
-	if (iicbus_request_bus(parent, sc->dev, IIC_WAIT) != 0)
+	if (!fetched)
 		goto rearm;
 
-	maxlen = sc->power_on ? sc->intr_bufsize : 0;
-	error = iichid_cmd_read(sc, sc->intr_buf, maxlen, &actual);
-	iicbus_release_bus(parent, sc->dev);
-	if (error != 0) {
-		DPRINTF(sc, "read error occured: %d\n", error);
+	if (sc->intr_error != 0) {
+		DPRINTF(sc, "read error occured: %d\n", sc->intr_error);
+		counter_u64_add(sc->stat_errors, 1);
 		goto rearm;
 	}
 
@@ -605,32 +745,247 @@ iichid_event_task(void *context, int pending)
 	mtx_lock(sc->intr_mtx);
 	locked = true;
 	if (actual > 0) {
-		if (sc->open)
-			sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
+		counter_u64_add(sc->stat_reports, 1);
+		if (sc->open) {
+			sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual,
+			    iichid_report_time(sc));
+			iichid_update_latency(sc);
+		}
 #ifdef IICHID_SAMPLING
 		sc->missing_samples = 0;
+		iichid_sampling_update(sc, true);
 #endif
-	} else
+	} else {
+		counter_u64_add(sc->stat_empty, 1);
 #ifdef IICHID_SAMPLING
 		++sc->missing_samples;
+		iichid_sampling_update(sc, false);
 #else
 		DPRINTF(sc, "no data received\n");
 #endif
+	}
 
 rearm:
 #ifdef IICHID_SAMPLING
+	if (!locked) {
+		mtx_lock(sc->intr_mtx);
+		locked = true;
+	}
 	if (sc->callout_setup && sc->sampling_rate_slow > 0 && sc->open) {
 		if (sc->missing_samples == sc->sampling_hysteresis)
-			sc->intr_handler(sc->intr_ctx, sc->intr_buf, 0);
-		taskqueue_enqueue_timeout(sc->taskqueue, &sc->periodic_task,
-		    hz / MAX(sc->missing_samples >= sc->sampling_hysteresis ?
-		      sc->sampling_rate_slow : sc->sampling_rate_fast, 1));
+			sc->intr_handler(sc->intr_ctx, sc->intr_buf, 0,
+			    sbinuptime());
+		if (sc->sampling_adaptive)
+			taskqueue_enqueue_timeout_sbt(sc->taskqueue,
+			    &sc->periodic_task, sc->sampling_period,
+			    sc->sampling_period >> 4, 0);
+		else
+			taskqueue_enqueue_timeout(sc->taskqueue,
+			    &sc->periodic_task,
+			    hz / MAX(sc->missing_samples >=
+			      sc->sampling_hysteresis ? sc->sampling_rate_slow :
+			      sc->sampling_rate_fast, 1));
 	}
 #endif
 	if (locked)
 		mtx_unlock(sc->intr_mtx);
 }
 
+/*
+ * Service all devices with pending input reports on the bus. Devices are
+ * read in the order their interrupts arrived, each one once per batch, so
+ * a chatty device can not starve its neighbours.
+ */
+static void
+iichid_worker_task(void *context, int pending)
+{
+	struct iichid_worker *w = context;
+	STAILQ_HEAD(, iichid_softc) batch = STAILQ_HEAD_INITIALIZER(batch);
+	struct iichid_softc *sc;
+	iichid_size_t maxlen;
+	device_t owner;
+	int error;
+
+	/*
+	 * Devices interrupting again while the batch is processed are put
+	 * back on the pending list, so the batch has its own linkage.
+	 */
+	mtx_lock(&w->mtx);
+	while ((sc = STAILQ_FIRST(&w->pending)) != NULL) {
+		STAILQ_REMOVE_HEAD(&w->pending, pending_link);
+		sc->pending = false;
+		STAILQ_INSERT_TAIL(&batch, sc, batch_link);
+	}
+	mtx_unlock(&w->mtx);
+
+	if (STAILQ_EMPTY(&batch))
+		return;
+
+	owner = STAILQ_FIRST(&batch)->dev;
+	error = iicbus_request_bus(w->bus, owner, IIC_WAIT);
+	if (error == 0) {
+		/*
+		 * Reading of input reports of I2C devices residing in SLEEP
+		 * state is not allowed and often returns a garbage. As some
+		 * hardware requires reads to acknoledge interrupts we fetch
+		 * only length header and discard it.
+		 */
+		STAILQ_FOREACH(sc, &batch, batch_link) {
+			maxlen = sc->power_on ? sc->intr_bufsize : 0;
+			sc->intr_actual = 0;
+			sc->intr_error = iichid_cmd_read_intr(sc, maxlen,
+			    &sc->intr_actual);
+		}
+		iicbus_release_bus(w->bus, owner);
+	}
+
+	STAILQ_FOREACH(sc, &batch, batch_link)
+		iichid_event_done(sc, error == 0);
+}
+
+/* Queue device for reading of input report by bus worker */
+static void
+iichid_event_enqueue(struct iichid_softc *sc)
+{
+	struct iichid_worker *w = sc->worker;
+
+	mtx_lock(&w->mtx);
+	if (!sc->pending) {
+		STAILQ_INSERT_TAIL(&w->pending, sc, pending_link);
+		sc->pending = true;
+	}
+	mtx_unlock(&w->mtx);
+	taskqueue_enqueue(w->taskqueue, &w->task);
+}
+
+/* Remove device from bus worker queue and wait for the batch to finish */
+static void
+iichid_event_drain(struct iichid_softc *sc)
+{
+	struct iichid_worker *w = sc->worker;
+
+	mtx_lock(&w->mtx);
+	if (sc->pending) {
+		STAILQ_REMOVE(&w->pending, sc, iichid_softc, pending_link);
+		sc->pending = false;
+	}
+	mtx_unlock(&w->mtx);
+	taskqueue_drain(w->taskqueue, &w->task);
+}
+
+#ifdef IICHID_SAMPLING
+static void
+iichid_periodic_task(void *context, int pending)
+{
+
+	iichid_event_enqueue(context);
+}
+#endif
+
+static struct iichid_worker *
+iichid_worker_get(device_t bus)
+{
+	struct iichid_worker *w;
+
+	sx_xlock(&iichid_worker_lock);
+	LIST_FOREACH(w, &iichid_workers, link)
+		if (w->bus == bus)
+			break;
+	if (w == NULL) {
+		w = malloc(sizeof(*w), M_DEVBUF, M_WAITOK | M_ZERO);
+		w->bus = bus;
+		mtx_init(&w->mtx, "iichid worker", NULL, MTX_DEF);
+		STAILQ_INIT(&w->pending);
+		TASK_INIT(&w->task, 0, iichid_worker_task, w);
+		/* taskqueue_create can't fail with M_WAITOK mflag passed */
+		w->taskqueue = taskqueue_create("imt_tq", M_WAITOK | M_ZERO,
+		    taskqueue_thread_enqueue, &w->taskqueue);
+		taskqueue_start_threads(&w->taskqueue, 1, PI_TTY,
+		    "iichid %s taskq", device_get_nameunit(bus));
+		LIST_INSERT_HEAD(&iichid_workers, w, link);
+	}
+	w->refs++;
+	sx_xunlock(&iichid_worker_lock);
+
+	return (w);
+}
+
+static void
+iichid_worker_put(struct iichid_worker *w)
+{
+
+	sx_xlock(&iichid_worker_lock);
+	if (--w->refs != 0) {
+		sx_xunlock(&iichid_worker_lock);
+		return;
+	}
+	LIST_REMOVE(w, link);
+	sx_xunlock(&iichid_worker_lock);
+
+	taskqueue_free(w->taskqueue);
+	mtx_destroy(&w->mtx);
+	free(w, M_DEVBUF);
+}
+
+static int
+iichid_sysctl_latency_handler(SYSCTL_HANDLER_ARGS)
+{
+	struct iichid_softc *sc;
+	int value = 0;
+
+	sc = arg1;
+
+	if (sc->intr_mtx != NULL) {
+		mtx_lock(sc->intr_mtx);
+		value = sbttous(sc->intr_latency);
+		mtx_unlock(sc->intr_mtx);
+	}
+
+	return (sysctl_handle_int(oidp, &value, 0, req));
+}
+
+static void
+iichid_stats_init(struct iichid_softc *sc)
+{
+	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(sc->dev);
+	struct sysctl_oid *tree;
+
+	sc->stat_reports = counter_u64_alloc(M_WAITOK);
+	sc->stat_empty = counter_u64_alloc(M_WAITOK);
+	sc->stat_errors = counter_u64_alloc(M_WAITOK);
+	hid_latency_alloc(sc->stat_latency);
+
+	tree = SYSCTL_ADD_NODE(ctx,
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "stats", CTLFLAG_RD, NULL, "statistics");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree),
+		OID_AUTO, "reports", CTLFLAG_RD, &sc->stat_reports,
+		"number of input reports read");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree),
+		OID_AUTO, "empty", CTLFLAG_RD, &sc->stat_empty,
+		"number of reads returned no input report");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree),
+		OID_AUTO, "errors", CTLFLAG_RD, &sc->stat_errors,
+		"number of I2C read errors");
+	SYSCTL_ADD_COUNTER_U64_ARRAY(ctx, SYSCTL_CHILDREN(tree),
+		OID_AUTO, "latency", CTLFLAG_RD, sc->stat_latency,
+		HID_LATENCY_NBUCKETS,
+		"interrupt to report processed latency, log2(us) histogram");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree),
+		OID_AUTO, "resume_latency", CTLFLAG_RD, &sc->resume_latency, 0,
+		"resume to first input report processed latency, us");
+}
+
+static int
+iichid_intr_filter(void *context)
+{
+	struct iichid_softc *sc = context;
+
+	sc->intr_time = sbinuptime();
+
+	return (FILTER_SCHEDULE_THREAD);
+}
+
 static void
 iichid_intr(void *context)
 {
@@ -645,9 +1000,13 @@ iichid_intr(void *context)
 	 * Requesting of an I2C bus with IIC_DONTWAIT parameter enables polled
 	 * mode in the driver, making possible iicbus_transfer execution from
 	 * interrupt handlers and callouts.
+	 * Fall back to bus worker if direct mode is disabled or bus is busy.
 	 */
-	if (iicbus_request_bus(parent, sc->dev, IIC_DONTWAIT) != 0)
+	if (!sc->intr_direct ||
+	    iicbus_request_bus(parent, sc->dev, IIC_DONTWAIT) != 0) {
+		iichid_event_enqueue(sc);
 		return;
+	}
 
 	/*
 	 * Reading of input reports of I2C devices residing in SLEEP state is
@@ -657,10 +1016,11 @@ iichid_intr(void *context)
 	 * acknoledge interrupts we fetch only length header and discard it.
 	 */
 	maxlen = sc->power_on ? sc->intr_bufsize : 0;
-	error = iichid_cmd_read(sc, sc->intr_buf, maxlen, &actual);
+	error = iichid_cmd_read_intr(sc, maxlen, &actual);
 	iicbus_release_bus(parent, sc->dev);
 	if (error != 0) {
 		DPRINTF(sc, "read error occured: %d\n", error);
+		counter_u64_add(sc->stat_errors, 1);
 		return;
 	}
 
@@ -669,18 +1029,51 @@ iichid_intr(void *context)
 
 	if (actual == 0) {
 		DPRINTF(sc, "no data received\n");
+		counter_u64_add(sc->stat_empty, 1);
 		return;
 	}
 
+	counter_u64_add(sc->stat_reports, 1);
 	mtx_lock(sc->intr_mtx);
-	if (sc->open)
-		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
+	if (sc->open) {
+		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual,
+		    iichid_report_time(sc));
+		iichid_update_latency(sc);
+	}
 	mtx_unlock(sc->intr_mtx);
 #else
-	taskqueue_enqueue(sc->taskqueue, &sc->event_task);
+	iichid_event_enqueue(sc);
 #endif
 }
 
+/*
+ * HID and report descriptors are kept by iichid and hidbus across suspend,
+ * so the device is neither reset nor its descriptors are fetched again on
+ * resume. Just make sure that the device has not been replaced meanwhile by
+ * rereading of 30 bytes of HID descriptor. Attached hidbus children decode
+ * reports with the layout of the old report descriptor, so a changed device
+ * is left powered off and all transfers to it fail until iichid is
+ * reattached. Called with iicbus owned and device powered on.
+ */
+static void
+iichid_verify_hid_desc(struct iichid_softc *sc)
+{
+	struct i2c_hid_desc desc;
+	int error;
+
+	error = iichid_cmd_get_hid_desc(sc, sc->config_reg, &desc);
+	if (error != 0) {
+		DPRINTF(sc, "Could not verify HID descriptor, error: %d\n",
+		    error);
+		return;
+	}
+	if (memcmp(&desc, &sc->desc, sizeof(desc)) != 0) {
+		device_printf(sc->dev, "HID descriptor has changed across "
+		    "suspend, disabling device. Reattach iichid to use it\n");
+		sc->stale = true;
+	}
+}
+
 static int
 iichid_set_power_state(struct iichid_softc *sc, enum iichid_powerstate_how how)
 {
@@ -710,7 +1103,7 @@ iichid_set_power_state(struct iichid_softc *sc, enum iichid_powerstate_how how)
 
 	mtx_lock(sc->intr_mtx);
 again:
-	power_on = sc->open & !sc->suspend;
+	power_on = sc->open & !sc->suspend & !sc->stale;
 	mtx_unlock(sc->intr_mtx);
 
 	if (power_on != sc->power_on) {
@@ -718,10 +1111,20 @@ again:
 		    power_on ? I2C_HID_POWER_ON : I2C_HID_POWER_OFF);
 
 		sc->power_on = power_on;
+		/* Descriptors can be checked only in ON power state */
+		if (power_on && sc->verify_desc) {
+			sc->verify_desc = false;
+			iichid_verify_hid_desc(sc);
+		}
 		mtx_lock(sc->intr_mtx);
 		/* Redo command if sc->open has been changed */
-		if (power_on != (sc->open & !sc->suspend))
+		if (power_on != (sc->open & !sc->suspend & !sc->stale))
 			goto again;
+		/* Start resume latency measurement from powered up device */
+		if (power_on && how == IICHID_PS_RESUME) {
+			sc->resume_time = sbinuptime();
+			sc->intr_time = 0;
+		}
 #ifdef IICHID_SAMPLING
 		if (sc->sampling_rate_slow >= 0 && sc->intr_handler != NULL) {
 			if (power_on) {
@@ -747,13 +1150,68 @@ iichid_power_task(void *context, int pending)
 	(void)iichid_set_power_state(sc, IICHID_PS_NOCHANGE);
 }
 
+static int
+iichid_cmd_request(struct iichid_softc *sc, struct hid_request *req)
+{
+	iichid_size_t actlen = 0;
+	int error;
+
+	if (sc->stale)
+		return (ENXIO);
+	if (req->intr)
+		error = iichid_cmd_write(sc, req->data, req->len);
+	else if (req->write)
+		error = iichid_cmd_set_report(sc, req->data, req->len,
+		    req->type, req->id);
+	else
+		error = iichid_cmd_get_report(sc, req->data, req->len,
+		    &actlen, req->type, req->id);
+	req->actlen = error == 0 ? actlen : 0;
+
+	return (iic2errno(error));
+}
+
+/*
+ * Execute all queued asynchronous GET/SET_REPORT requests and output report
+ * writes back to back
+ * within single bus ownership period and run completion callbacks.
+ */
+static void
+iichid_req_task(void *context, int pending)
+{
+	struct iichid_softc *sc = context;
+	device_t parent = device_get_parent(sc->dev);
+	STAILQ_HEAD(, hid_request) done = STAILQ_HEAD_INITIALIZER(done);
+	struct hid_request *req;
+	int error;
+
+	mtx_lock(sc->intr_mtx);
+	STAILQ_CONCAT(&done, &sc->req_queue);
+	mtx_unlock(sc->intr_mtx);
+
+	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
+	STAILQ_FOREACH(req, &done, link)
+		req->error = error != 0 ? iic2errno(error) :
+		    iichid_cmd_request(sc, req);
+	if (error == 0)
+		iicbus_release_bus(parent, sc->dev);
+
+	mtx_lock(sc->intr_mtx);
+	while ((req = STAILQ_FIRST(&done)) != NULL) {
+		STAILQ_REMOVE_HEAD(&done, link);
+		req->cb(req);
+	}
+	mtx_unlock(sc->intr_mtx);
+}
+
 static int
 iichid_setup_interrupt(struct iichid_softc *sc)
 {
 	sc->irq_cookie = 0;
 
 	int error = bus_setup_intr(sc->dev, sc->irq_res,
-	    INTR_TYPE_TTY|INTR_MPSAFE, NULL, iichid_intr, sc, &sc->irq_cookie);
+	    INTR_TYPE_TTY|INTR_MPSAFE, iichid_intr_filter, iichid_intr, sc,
+	    &sc->irq_cookie);
 	if (error != 0)
 		DPRINTF(sc, "Could not setup interrupt handler\n");
 	else
@@ -772,6 +1230,49 @@ iichid_teardown_interrupt(struct iichid_softc *sc)
 }
 
 #ifdef IICHID_SAMPLING
+/*
+ * Adaptive sampling. Estimate report interval with exponential moving
+ * average of delays between consecutive reports within a burst and schedule
+ * next sample a bit ahead of the expected report. Back off geometrically
+ * toward slow rate once the device stops sending reports.
+ */
+static void
+iichid_sampling_update(struct iichid_softc *sc, bool received)
+{
+	sbintime_t now, delta, slow;
+
+	mtx_assert(sc->intr_mtx, MA_OWNED);
+
+	if (!sc->sampling_adaptive || !sc->callout_setup)
+		return;
+
+	slow = SBT_1S / MAX(sc->sampling_rate_slow, 1);
+	if (received) {
+		now = sbinuptime();
+		delta = now - sc->last_report;
+		sc->last_report = now;
+		if (delta < slow) {
+			if (sc->report_interval == 0)
+				sc->report_interval = delta;
+			else
+				sc->report_interval +=
+				    (delta - sc->report_interval) / 4;
+			sc->sampling_period =
+			    sc->report_interval - sc->report_interval / 8;
+		} else {
+			/* First report of a burst. Cadence is unknown yet */
+			sc->report_interval = 0;
+			sc->sampling_period =
+			    SBT_1S / MAX(sc->sampling_rate_fast, 1);
+		}
+	} else if (sc->missing_samples >= sc->sampling_hysteresis)
+		sc->sampling_period += sc->sampling_period / 2;
+
+	sc->sampling_period = MAX(sc->sampling_period,
+	    SBT_1S / IICHID_SAMPLING_RATE_MAX);
+	sc->sampling_period = MIN(sc->sampling_period, slow);
+}
+
 static int
 iichid_setup_callout(struct iichid_softc *sc)
 {
@@ -805,7 +1306,10 @@ iichid_reset_callout(struct iichid_softc *sc)
 
 	/* Start with slow sampling */
 	sc->missing_samples = sc->sampling_hysteresis;
-	taskqueue_enqueue(sc->taskqueue, &sc->event_task);
+	sc->sampling_period = SBT_1S / sc->sampling_rate_slow;
+	sc->report_interval = 0;
+	sc->last_report = 0;
+	iichid_event_enqueue(sc);
 
 	return (0);
 }
@@ -872,6 +1376,35 @@ iichid_sysctl_sampling_rate_handler(SYSCTL_HANDLER_ARGS)
 
 	return (0);
 }
+
+static int
+iichid_sysctl_sampling_stat_handler(SYSCTL_HANDLER_ARGS)
+{
+	struct iichid_softc *sc;
+	sbintime_t period = 0;
+	int value = 0;
+
+	sc = arg1;
+
+	if (sc->intr_mtx != NULL) {
+		mtx_lock(sc->intr_mtx);
+		if (!sc->callout_setup || sc->sampling_rate_slow <= 0)
+			period = 0;
+		else if (sc->sampling_adaptive)
+			period = sc->sampling_period;
+		else
+			period = SBT_1S / MAX(sc->missing_samples >=
+			    sc->sampling_hysteresis ? sc->sampling_rate_slow :
+			    sc->sampling_rate_fast, 1);
+		mtx_unlock(sc->intr_mtx);
+	}
+
+	/* Report is expected to wait half of sampling period on average */
+	if (period != 0)
+		value = arg2 == 0 ? SBT_1S / period : sbttous(period) / 2;
+
+	return (sysctl_handle_int(oidp, &value, 0, req));
+}
 #endif /* IICHID_SAMPLING */
 
 static void
@@ -891,10 +1424,9 @@ iichid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	sc->intr_handler = intr;
 	sc->intr_ctx = context;
 	sc->intr_mtx = mtx;
-	sc->intr_buf = malloc(rdesc->rdsize, M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->intr_xfer = malloc(rdesc->rdsize + 2, M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->intr_buf = sc->intr_xfer + 2;
 	sc->intr_bufsize = rdesc->rdsize;
-	taskqueue_start_threads(&sc->taskqueue, 1, PI_TTY,
-	    "%s taskq", device_get_nameunit(sc->dev));
 }
 
 static void
@@ -902,8 +1434,13 @@ iichid_intr_unsetup(device_t dev)
 {
 	struct iichid_softc* sc = device_get_softc(dev);
 
-	taskqueue_drain_all(sc->taskqueue);
-	free(sc->intr_buf, M_DEVBUF);
+#ifdef IICHID_SAMPLING
+	taskqueue_drain_timeout(sc->taskqueue, &sc->periodic_task);
+#endif
+	taskqueue_drain(sc->taskqueue, &sc->power_task);
+	taskqueue_drain(sc->taskqueue, &sc->req_task);
+	iichid_event_drain(sc);
+	free(sc->intr_xfer, M_DEVBUF);
 }
 
 static int
@@ -949,9 +1486,10 @@ iichid_intr_poll(device_t dev)
 	iichid_size_t actual = 0;
 	int error;
 
-	error = iichid_cmd_read(sc, sc->intr_buf, sc->intr_bufsize, &actual);
+	error = iichid_cmd_read_intr(sc, sc->intr_bufsize, &actual);
 	if (error == 0 && actual != 0 && sc->open)
-		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual);
+		sc->intr_handler(sc->intr_ctx, sc->intr_buf, actual,
+		    sbinuptime());
 }
 
 /*
@@ -982,6 +1520,8 @@ iichid_read(device_t dev, void *buf, hid_size_t maxlen, hid_size_t *actlen)
 
 	if (maxlen > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
+	if (sc->stale)
+		return (ENXIO);
 
 	error = iicbus_request_bus(parent, sc->dev, IIC_WAIT);
 	if (error == 0) {
@@ -999,6 +1539,8 @@ iichid_write(device_t dev, const void *buf, hid_size_t len)
 
 	if (len > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
+	if (sc->stale)
+		return (ENXIO);
 
 	return (iic2errno(iichid_cmd_write(sc, buf, len)));
 }
@@ -1011,6 +1553,8 @@ iichid_get_report(device_t dev, void *buf, hid_size_t maxlen,
 
 	if (maxlen > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
+	if (sc->stale)
+		return (ENXIO);
 
 	return (iic2errno(
 	    iichid_cmd_get_report(sc, buf, maxlen, actlen, type, id)));
@@ -1024,10 +1568,34 @@ iichid_set_report(device_t dev, const void *buf, hid_size_t len, uint8_t type,
 
 	if (len > IICHID_SIZE_MAX)
 		return (EMSGSIZE);
+	if (sc->stale)
+		return (ENXIO);
 
 	return (iic2errno(iichid_cmd_set_report(sc, buf, len, type, id)));
 }
 
+static int
+iichid_submit_report(device_t dev, struct hid_request *req)
+{
+	struct iichid_softc* sc = device_get_softc(dev);
+
+	if (req->len > IICHID_SIZE_MAX)
+		return (EMSGSIZE);
+
+	if (HID_IN_POLLING_MODE_FUNC()) {
+		req->error = iichid_cmd_request(sc, req);
+		req->cb(req);
+		return (0);
+	}
+
+	mtx_lock(sc->intr_mtx);
+	STAILQ_INSERT_TAIL(&sc->req_queue, req, link);
+	mtx_unlock(sc->intr_mtx);
+	taskqueue_enqueue(sc->taskqueue, &sc->req_task);
+
+	return (0);
+}
+
 static int
 iichid_set_idle(device_t dev, uint16_t duration, uint8_t id)
 {
@@ -1190,14 +1758,15 @@ iichid_attach(device_t dev)
 	}
 
 	sc->power_on = false;
-	TASK_INIT(&sc->event_task, 0, iichid_event_task, sc);
 	TASK_INIT(&sc->power_task, 0, iichid_power_task, sc);
-	/* taskqueue_create can't fail with M_WAITOK mflag passed */
-	sc->taskqueue = taskqueue_create("imt_tq", M_WAITOK | M_ZERO,
-	    taskqueue_thread_enqueue, &sc->taskqueue);
+	TASK_INIT(&sc->req_task, 0, iichid_req_task, sc);
+	STAILQ_INIT(&sc->req_queue);
+	sc->worker = iichid_worker_get(device_get_parent(dev));
+	sc->taskqueue = sc->worker->taskqueue;
+	iichid_stats_init(sc);
 #ifdef IICHID_SAMPLING
 	TIMEOUT_TASK_INIT(sc->taskqueue, &sc->periodic_task, 0,
-	    iichid_event_task, sc);
+	    iichid_periodic_task, sc);
 
 	sc->sampling_rate_slow = -1;
 	sc->sampling_rate_fast = IICHID_SAMPLING_RATE_FAST;
@@ -1226,6 +1795,26 @@ iichid_attach(device_t dev)
 #endif
 	}
 
+	sc->single_read = true;
+	SYSCTL_ADD_BOOL(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "single_read", CTLFLAG_RWTUN,
+		&sc->single_read, 0,
+		"fetch input report with single I2C transaction");
+#ifdef HAVE_IG4_POLLING
+	sc->intr_direct = true;
+	SYSCTL_ADD_BOOL(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "intr_direct", CTLFLAG_RWTUN,
+		&sc->intr_direct, 0,
+		"fetch input reports in interrupt thread instead of taskqueue");
+#endif
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "intr_latency", CTLTYPE_INT | CTLFLAG_RD,
+		sc, 0, iichid_sysctl_latency_handler, "I",
+		"average interrupt to report delivery latency in microseconds");
+
 #ifdef IICHID_SAMPLING
 	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
 		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
@@ -1242,6 +1831,21 @@ iichid_attach(device_t dev)
 		OID_AUTO, "sampling_hysteresis", CTLTYPE_INT | CTLFLAG_RWTUN,
 		&sc->sampling_hysteresis, 0,
 		"number of missing samples before enabling of slow mode");
+	SYSCTL_ADD_BOOL(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_adaptive", CTLFLAG_RWTUN,
+		&sc->sampling_adaptive, 0,
+		"adapt sampling rate to observed report cadence");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_rate", CTLTYPE_INT | CTLFLAG_RD,
+		sc, 0, iichid_sysctl_sampling_stat_handler, "I",
+		"current sampling rate in num/second");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+		SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		OID_AUTO, "sampling_latency", CTLTYPE_INT | CTLFLAG_RD,
+		sc, 1, iichid_sysctl_sampling_stat_handler, "I",
+		"estimated average report latency in microseconds");
 	hid_add_dynamic_quirk(&sc->hw, HQ_IICHID_SAMPLING);
 #endif /* IICHID_SAMPLING */
 
@@ -1278,10 +1882,16 @@ iichid_detach(device_t dev)
 		bus_release_resource(dev, SYS_RES_IRQ, sc->irq_rid,
 		    sc->irq_res);
 
-	if (sc->taskqueue)
-		taskqueue_free(sc->taskqueue);
+	if (sc->worker != NULL)
+		iichid_worker_put(sc->worker);
+	sc->worker = NULL;
 	sc->taskqueue = NULL;
 
+	counter_u64_free(sc->stat_reports);
+	counter_u64_free(sc->stat_empty);
+	counter_u64_free(sc->stat_errors);
+	hid_latency_free(sc->stat_latency);
+
 	return (0);
 }
 
@@ -1390,10 +2000,17 @@ static int
 iichid_resume(device_t dev)
 {
 	struct iichid_softc *sc = device_get_softc(dev);
+	device_t parent = device_get_parent(dev);
 	int error;
 
 	DPRINTF(sc, "Resume called, setting device to power_state 0\n");
 
+	/* Check the device on the first power up after resume */
+	if (iicbus_request_bus(parent, dev, IIC_WAIT) == 0) {
+		sc->verify_desc = true;
+		iicbus_release_bus(parent, dev);
+	}
+
 	error = iichid_set_power_state(sc, IICHID_PS_RESUME);
 	if (error != 0)
 		DPRINTF(sc, "Could not set power_state, error: %d\n", error);
@@ -1430,6 +2047,7 @@ static device_method_t iichid_methods[] = {
 	DEVMETHOD(hid_write,		iichid_write),
 	DEVMETHOD(hid_get_report,	iichid_get_report),
 	DEVMETHOD(hid_set_report,	iichid_set_report),
+	DEVMETHOD(hid_submit_report,	iichid_submit_report),
 	DEVMETHOD(hid_set_idle,		iichid_set_idle),
 	DEVMETHOD(hid_set_protocol,	iichid_set_protocol),
 
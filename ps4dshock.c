@@ -39,6 +39,7 @@ __FBSDID("$FreeBSD$");
 #include <sys/bus.h>
 #include <sys/kernel.h>
 #include <sys/lock.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/sx.h>
 #include <sys/sysctl.h>
@@ -594,10 +595,12 @@ static const uint8_t	ps4dshock_rdesc[] = {
 
 #define	PS4DS_GYRO_RES_PER_DEG_S	1024
 #define	PS4DS_ACC_RES_PER_G		8192
+#define	PS4DS_CALIB_SHIFT		16	/* Fixed point multiplier */
 #define	PS4DS_MAX_TOUCHPAD_PACKETS	4
 #define	PS4DS_FEATURE_REPORT2_SIZE	37
 #define	PS4DS_OUTPUT_REPORT5_SIZE	32
 #define	PS4DS_OUTPUT_REPORT11_SIZE	78
+#define	PS4DS_OUTPUT_NSLOTS		3	/* Sent, pending and built */
 
 static hidmap_cb_t	ps4dshock_final_cb;
 static hidmap_cb_t	ps4dsacc_data_cb;
@@ -652,6 +655,10 @@ struct ps4ds_calib_data {
 	int16_t bias;
 	int32_t sens_numer;
 	int32_t sens_denom;
+	/* (data - bias) * sens_numer / sens_denom precomputed in fixed point */
+	int64_t mult;
+	int64_t offset;
+	int32_t value;		/* Last calibrated value */
 };
 
 enum {
@@ -689,6 +696,7 @@ struct ps4dsacc_softc {
 	int32_t			ev_tstamp;
 
 	struct ps4ds_calib_data	calib_data[6];
+	u_int			changed;	/* Bitmask of calib_data */
 };
 
 struct ps4dsmtp_softc {
@@ -719,9 +727,11 @@ enum {
 #define PS4DS_MAP_BTN(number, code)		\
 	{ HIDMAP_KEY(HUP_BUTTON, number, code) }
 #define PS4DS_MAP_ABS(usage, code)		\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code) }
+	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
+	    .derive_fuzz = true }
 #define PS4DS_MAP_FLT(usage, code)		\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code), .flat = 15 }
+	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
+	    .flat = 15, .derive_fuzz = true }
 #define PS4DS_MAP_VSW(usage, code)	\
 	{ HIDMAP_SW(HUP_MICROSOFT, usage, code) }
 #define PS4DS_MAP_GCB(usage, callback)	\
@@ -815,6 +825,7 @@ ps4dsacc_data_cb(HIDMAP_CB_ARGS)
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
 	struct ps4dsacc_softc *sc = HIDMAP_CB_GET_SOFTC();
 	struct ps4ds_calib_data *calib;
+	int32_t value;
 	u_int i;
 
 	switch (HIDMAP_CB_GET_STATE()) {
@@ -833,10 +844,14 @@ ps4dsacc_data_cb(HIDMAP_CB_ARGS)
 		break;
 
 	case HIDMAP_CB_IS_RUNNING:
+		/* Axes are pushed all together by final callback */
 		calib = HIDMAP_CB_UDATA;
-		evdev_push_abs(evdev, calib->code,
-		    ((int64_t)ctx.data - calib->bias) * calib->sens_numer /
-		    calib->sens_denom);
+		value = (ctx.data * calib->mult + calib->offset) >>
+		    PS4DS_CALIB_SHIFT;
+		if (value != calib->value) {
+			calib->value = value;
+			sc->changed |= 1 << (calib - sc->calib_data);
+		}
 		break;
 
 	default:
@@ -855,6 +870,8 @@ ps4dsacc_tstamp_cb(HIDMAP_CB_ARGS)
 
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
+		/* Hardware timestamps take precedence over transport ones */
+		hm->do_timestamps = false;
 		evdev_support_event(evdev, EV_MSC);
 		evdev_support_msc(evdev, MSC_TIMESTAMP);
 		break;
@@ -878,13 +895,30 @@ static int
 ps4dsacc_final_cb(HIDMAP_CB_ARGS)
 {
 	struct evdev_dev *evdev = HIDMAP_CB_GET_EVDEV();
+	struct ps4dsacc_softc *sc = HIDMAP_CB_GET_SOFTC();
+	int i;
 
-	if (HIDMAP_CB_GET_STATE() == HIDMAP_CB_IS_ATTACHING) {
+	switch (HIDMAP_CB_GET_STATE()) {
+	case HIDMAP_CB_IS_ATTACHING:
 		evdev_support_event(evdev, EV_ABS);
 		evdev_support_prop(evdev, INPUT_PROP_ACCELEROMETER);
+		break;
+
+	case HIDMAP_CB_IS_RUNNING:
+		/* Push sensor frame skipping axes which have not changed */
+		while (sc->changed != 0) {
+			i = ffs(sc->changed) - 1;
+			sc->changed &= ~(1 << i);
+			evdev_push_abs(evdev, sc->calib_data[i].code,
+			    sc->calib_data[i].value);
+		}
+		break;
+
+	default:
+		break;
 	}
-        /* Do not execute callback at interrupt handler and detach */
-        return (ENOSYS);
+
+	return (0);
 }
 
 static int
@@ -969,8 +1003,10 @@ ps4dsmtp_final_cb(HIDMAP_CB_ARGS)
 	switch (HIDMAP_CB_GET_STATE()) {
 	case HIDMAP_CB_IS_ATTACHING:
 		if (hid_test_quirk(hid_get_device_info(sc->hm.dev),
-		    HQ_MT_TIMESTAMP))
+		    HQ_MT_TIMESTAMP)) {
 			sc->do_tstamps = true;
+			hm->do_timestamps = false;
+		}
 		/*
 		 * Dualshock 4 touchpad TLC contained in fixed report
 		 * descriptor is almost compatible with MS precission touchpad
@@ -1024,10 +1060,21 @@ ps4dshock_write(struct ps4dshock_softc *sc)
 {
 	hid_size_t osize = sc->is_bluetooth ?
 	    PS4DS_OUTPUT_REPORT11_SIZE : PS4DS_OUTPUT_REPORT5_SIZE;
-	uint8_t buf[osize];
-	int offset;
+	uint8_t local_buf[PS4DS_OUTPUT_REPORT11_SIZE], *buf;
+	int offset, error;
 	bool led_on, led_blinks;
 
+	/*
+	 * Build report directly in output pool buffer. Pool coalesces
+	 * updates, so only the latest LED and rumble state is sent if
+	 * they come faster than the device accepts them.
+	 */
+	error = hidbus_output_get(sc->hm.dev, osize, (void **)&buf, M_WAITOK);
+	if (error == ENOBUFS)
+		buf = local_buf;
+	else if (error != 0)
+		return (error);
+
 	memset(buf, 0, osize);
 	buf[0] = sc->is_bluetooth ? 0x11 : 0x05;
 	offset = sc->is_bluetooth ? 3 : 1;
@@ -1067,7 +1114,10 @@ ps4dshock_write(struct ps4dshock_softc *sc)
 	}
 #endif
 
-	return (hid_write(sc->hm.dev, buf, osize));
+	if (buf == local_buf)
+		return (hid_write(sc->hm.dev, buf, osize));
+
+	return (hidbus_output_submit(sc->hm.dev, buf, osize));
 }
 
 /* Synaptics Touchpad */
@@ -1192,6 +1242,7 @@ ps4dshock_attach(device_t dev)
 	sc->led_color = ps4ds_leds[device_get_unit(dev) % nitems(ps4ds_leds)];
 	sc->led_delay_on = 500;	/* 1 Hz */
 	sc->led_delay_off = 500;
+	(void)hidbus_output_init(dev, PS4DS_OUTPUT_NSLOTS, true);
 	ps4dshock_write(sc);
 
 	sx_init(&sc->lock, "ps4dshock");
@@ -1229,19 +1280,43 @@ ps4dshock_attach(device_t dev)
 	return (hidmap_attach(&sc->hm));
 }
 
+/*
+ * Convert calibration to fixed point multiplier and offset so that samples
+ * are calibrated without division at interrupt time. Values are rounded to
+ * nearest. Broken calibration data results in raw values being reported.
+ */
+static void
+ps4dsacc_calib_init(struct ps4ds_calib_data *calib)
+{
+
+	if (calib->sens_denom == 0) {
+		DPRINTF("bad calibration for axis %d, ignored\n", calib->code);
+		calib->bias = 0;
+		calib->sens_numer = calib->sens_denom = 1;
+	}
+	calib->mult = ((int64_t)calib->sens_numer << PS4DS_CALIB_SHIFT) /
+	    calib->sens_denom;
+	calib->offset = -calib->bias * calib->mult +
+	    (1 << (PS4DS_CALIB_SHIFT - 1));
+	calib->value = 0;
+}
+
 static int
 ps4dsacc_attach(device_t dev)
 {
 	struct ps4dsacc_softc *sc = device_get_softc(dev);
 	uint8_t buf[PS4DS_FEATURE_REPORT2_SIZE];
 	int error, speed_2x, range_2g;
+	u_int i;
 
 	/* Read accelerometers and gyroscopes calibration data */
 	error = hid_get_report(dev, buf, sizeof(buf), NULL,
 	    HID_FEATURE_REPORT, 0x02);
-	if (error)
+	if (error) {
 		DPRINTF("get feature report failed, error=%d "
 		    "(ignored)\n", error);
+		memset(buf, 0, sizeof(buf));
+	}
 
 	DPRINTFN(5, "calibration data: %*D\n", (int)sizeof(buf), buf, " ");
 
@@ -1313,6 +1388,9 @@ ps4dsacc_attach(device_t dev)
 	sc->calib_data[5].sens_numer = 2 * PS4DS_ACC_RES_PER_G;
 	sc->calib_data[5].sens_denom = range_2g;
 
+	for (i = 0; i < nitems(sc->calib_data); i++)
+		ps4dsacc_calib_init(&sc->calib_data[i]);
+
 	return (hidmap_attach(&sc->hm));
 }
 
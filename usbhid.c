@@ -49,6 +49,7 @@ __FBSDID("$FreeBSD$");
 #include <sys/lock.h>
 #include <sys/mutex.h>
 #include <sys/condvar.h>
+#include <sys/counter.h>
 #include <sys/sysctl.h>
 #include <sys/sx.h>
 #include <sys/unistd.h>
@@ -81,6 +82,16 @@ static int usbhid_enable = 1;
 #endif
 SYSCTL_INT(_hw_usb_usbhid, OID_AUTO, enable, CTLFLAG_RWTUN,
     &usbhid_enable, 0, "Enable usbhid and prefer it to other USB HID drivers");
+
+#define	USBHID_INTR_IN_MAX	4	/* Max in-flight interrupt IN xfers */
+static int usbhid_intr_nxfers = 2;
+SYSCTL_INT(_hw_usb_usbhid, OID_AUTO, intr_nxfers, CTLFLAG_RWTUN,
+    &usbhid_intr_nxfers, 0,
+    "Number of queued interrupt IN transfers, 1-" __XSTRING(USBHID_INTR_IN_MAX));
+static int usbhid_intr_zerocopy = 1;
+SYSCTL_INT(_hw_usb_usbhid, OID_AUTO, intr_zerocopy, CTLFLAG_RWTUN,
+    &usbhid_intr_zerocopy, 0,
+    "Pass interrupt IN transfer buffer to HID drivers without copying");
 #ifdef USB_DEBUG
 static int usbhid_debug = 0;
 
@@ -92,9 +103,13 @@ enum {
 	USBHID_INTR_OUT_DT,
 	USBHID_INTR_IN_DT,
 	USBHID_CTRL_DT,
-	USBHID_N_TRANSFER,
+	USBHID_INTR_IN_DT1,	/* Extra interrupt IN xfers start here */
+	USBHID_N_TRANSFER = USBHID_INTR_IN_DT1 + USBHID_INTR_IN_MAX - 1,
 };
 
+#define	USBHID_INTR_IN_XFER(n)	\
+	((n) == 0 ? USBHID_INTR_IN_DT : USBHID_INTR_IN_DT1 + (n) - 1)
+
 struct usbhid_xfer_ctx;
 typedef int usbhid_callback_t(struct usbhid_xfer_ctx *xfer_ctx);
 
@@ -115,6 +130,7 @@ struct usbhid_xfer_ctx {
 	void *cb_ctx;
 	int waiters;
 	bool influx;
+	bool zerocopy;			/* buf points to xfer frame buffer */
 };
 
 struct usbhid_softc {
@@ -122,6 +138,13 @@ struct usbhid_softc {
 	void *sc_intr_ctx;
 	struct mtx *sc_intr_mtx;
 	void *sc_intr_buf;
+	int sc_intr_nxfers;
+	bool sc_intr_zerocopy;
+
+	/* Asynchronous GET/SET_REPORT requests, head is in progress */
+	STAILQ_HEAD(, hid_request) sc_ctrl_q;	/* sc_intr_mtx */
+	/* Asynchronous output report writes, head is being sent */
+	STAILQ_HEAD(, hid_request) sc_out_q;	/* sc_intr_mtx */
 
 	struct hid_device_info sc_hw;
 
@@ -132,12 +155,18 @@ struct usbhid_softc {
 	struct usb_device *sc_udev;
 	uint8_t	sc_iface_no;
 	uint8_t	sc_iface_index;
+
+	/* Statistics */
+	counter_u64_t sc_stat_reports;
+	counter_u64_t sc_stat_errors;
+	counter_u64_t sc_stat_latency[HID_LATENCY_NBUCKETS];
 };
 
 /* prototypes */
 
 static device_probe_t usbhid_probe;
 static device_attach_t usbhid_attach;
+static device_detach_t usbhid_detach;
 
 static usb_callback_t usbhid_intr_out_callback;
 static usb_callback_t usbhid_intr_in_callback;
@@ -145,6 +174,12 @@ static usb_callback_t usbhid_ctrl_callback;
 
 static usbhid_callback_t usbhid_intr_handler_cb;
 static usbhid_callback_t usbhid_sync_wakeup_cb;
+static usbhid_callback_t usbhid_async_cb;
+static usbhid_callback_t usbhid_out_async_cb;
+
+static void usbhid_ctrl_start(struct usbhid_softc *);
+static void usbhid_out_start(struct usbhid_softc *);
+static int usbhid_write(device_t, const void *, hid_size_t);
 
 static void
 usbhid_intr_out_callback(struct usb_xfer *xfer, usb_error_t error)
@@ -198,8 +233,10 @@ usbhid_intr_in_callback(struct usb_xfer *xfer, usb_error_t error)
 		DPRINTF("transferred!\n");
 
 		usbd_xfer_status(xfer, &actlen, NULL, NULL, NULL);
-		pc = usbd_xfer_get_frame(xfer, 0);
-		usbd_copy_out(pc, 0, xfer_ctx->buf, actlen);
+		if (!xfer_ctx->zerocopy) {
+			pc = usbd_xfer_get_frame(xfer, 0);
+			usbd_copy_out(pc, 0, xfer_ctx->buf, actlen);
+		}
 		xfer_ctx->req.intr.actlen = actlen;
 		if (xfer_ctx->cb(xfer_ctx) != 0)
 			return;
@@ -212,6 +249,9 @@ re_submit:
 
 	default:			/* Error */
 		if (error != USB_ERR_CANCELLED) {
+			if (xfer_ctx->cb == usbhid_intr_handler_cb)
+				counter_u64_add(((struct usbhid_softc *)
+				    xfer_ctx->cb_ctx)->sc_stat_errors, 1);
 			/* try to clear stall first */
 			usbd_xfer_set_stall(xfer);
 			goto re_submit;
@@ -231,6 +271,7 @@ usbhid_ctrl_callback(struct usb_xfer *xfer, usb_error_t error)
 
 	switch (USB_GET_STATE(xfer)) {
 	case USB_ST_SETUP:
+tr_setup:
 		if (!is_rd && len != 0) {
 			pc = usbd_xfer_get_frame(xfer, 1);
 			usbd_copy_in(pc, 0, xfer_ctx->buf, len);
@@ -258,7 +299,12 @@ usbhid_ctrl_callback(struct usb_xfer *xfer, usb_error_t error)
 		DPRINTFN(1, "error=%s\n", usbd_errstr(error));
 		xfer_ctx->error = EIO;
 tr_exit:
-		(void)xfer_ctx->cb(xfer_ctx);
+		/* Zero return means that next request has been loaded */
+		if (xfer_ctx->cb(xfer_ctx) == 0 && error != USB_ERR_CANCELLED) {
+			len = UGETW(req->wLength);
+			is_rd = (req->bmRequestType & UT_READ) != 0;
+			goto tr_setup;
+		}
 		return;
 	}
 }
@@ -267,9 +313,13 @@ static int
 usbhid_intr_handler_cb(struct usbhid_xfer_ctx *xfer_ctx)
 {
 	struct usbhid_softc *sc = xfer_ctx->cb_ctx;
+	sbintime_t start;
 
+	start = sbinuptime();
 	sc->sc_intr_handler(sc->sc_intr_ctx, xfer_ctx->buf,
-	    xfer_ctx->req.intr.actlen);
+	    xfer_ctx->req.intr.actlen, start);
+	counter_u64_add(sc->sc_stat_reports, 1);
+	hid_latency_record(sc->sc_stat_latency, sbinuptime() - start);
 
 	return (0);
 }
@@ -284,6 +334,72 @@ usbhid_sync_wakeup_cb(struct usbhid_xfer_ctx *xfer_ctx)
 	return (ECANCELED);
 }
 
+static int
+usbhid_async_cb(struct usbhid_xfer_ctx *xfer_ctx)
+{
+	struct usbhid_softc *sc = xfer_ctx->cb_ctx;
+	struct hid_request *req;
+	bool more;
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	req = STAILQ_FIRST(&sc->sc_ctrl_q);
+	STAILQ_REMOVE_HEAD(&sc->sc_ctrl_q, link);
+	req->error = xfer_ctx->error;
+	req->actlen = req->error == 0 && !req->write ? req->len : 0;
+
+	more = !STAILQ_EMPTY(&sc->sc_ctrl_q);
+	if (more)
+		usbhid_ctrl_start(sc);
+	else {
+		xfer_ctx->influx = false;
+		if (xfer_ctx->waiters != 0)
+			wakeup_one(&xfer_ctx->waiters);
+	}
+
+	req->cb(req);
+
+	return (more ? 0 : ECANCELED);
+}
+
+static int
+usbhid_out_async_cb(struct usbhid_xfer_ctx *xfer_ctx)
+{
+	struct usbhid_softc *sc = xfer_ctx->cb_ctx;
+	struct hid_request *req;
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	/* Cancellation of transfer which has already sent the queue */
+	if (STAILQ_EMPTY(&sc->sc_out_q))
+		return (ECANCELED);
+
+	/*
+	 * Report is done as soon as it is copied to the frame buffer. If
+	 * transfer has been cancelled, nobody will restart it, so fail the
+	 * rest of queue too.
+	 */
+	do {
+		req = STAILQ_FIRST(&sc->sc_out_q);
+		STAILQ_REMOVE_HEAD(&sc->sc_out_q, link);
+		req->error = xfer_ctx->error;
+		req->actlen = 0;
+		req->cb(req);
+	} while (xfer_ctx->error != 0 && !STAILQ_EMPTY(&sc->sc_out_q));
+
+	/* Next report is submitted on completion of current transfer */
+	if (!STAILQ_EMPTY(&sc->sc_out_q))
+		usbhid_out_start(sc);
+	else {
+		xfer_ctx->req.intr.maxlen = 0;
+		xfer_ctx->influx = false;
+		if (xfer_ctx->waiters != 0)
+			wakeup_one(&xfer_ctx->waiters);
+	}
+
+	return (0);
+}
+
 static const struct usb_config usbhid_config[USBHID_N_TRANSFER] = {
 
 	[USBHID_INTR_OUT_DT] = {
@@ -324,9 +440,30 @@ usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	sc->sc_intr_mtx = mtx;
 	bcopy(usbhid_config, sc->sc_config, sizeof(usbhid_config));
 
+	/*
+	 * Queue several interrupt IN transfers on the same endpoint. USB stack
+	 * starts the next one as soon as previous is completed, so the
+	 * endpoint is not idle while HID drivers process the report.
+	 * Completions are delivered in submission order.
+	 */
+	sc->sc_intr_nxfers = MAX(1, MIN(usbhid_intr_nxfers,
+	    USBHID_INTR_IN_MAX));
+	for (n = 1; n < USBHID_INTR_IN_MAX; n++)
+		sc->sc_config[USBHID_INTR_IN_XFER(n)] =
+		    usbhid_config[USBHID_INTR_IN_DT];
+
+	/*
+	 * proxy_buffer makes frame buffer virtually contiguous so it can be
+	 * passed to interrupt handler as is. It is valid until the callback
+	 * returns and transfer is resubmitted, so handlers must copy data
+	 * they want to keep, like hidraw does.
+	 */
+	sc->sc_intr_zerocopy = usbhid_intr_zerocopy != 0;
+
 	/* Set buffer sizes to match HID report sizes */
 	sc->sc_config[USBHID_INTR_OUT_DT].bufsize = rdesc->osize;
-	sc->sc_config[USBHID_INTR_IN_DT].bufsize = rdesc->isize;
+	for (n = 0; n < USBHID_INTR_IN_MAX; n++)
+		sc->sc_config[USBHID_INTR_IN_XFER(n)].bufsize = rdesc->isize;
 	sc->sc_config[USBHID_CTRL_DT].bufsize =
 	    MAX(rdesc->isize, MAX(rdesc->osize, rdesc->fsize));
 
@@ -341,6 +478,9 @@ usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	for (n = 0; n != USBHID_N_TRANSFER; n++) {
 		if (nowrite && n == USBHID_INTR_OUT_DT)
 			continue;
+		if (n >= USBHID_INTR_IN_DT1 &&
+		    n - USBHID_INTR_IN_DT1 + 1 >= sc->sc_intr_nxfers)
+			continue;
 		error = usbd_transfer_setup(sc->sc_udev, &sc->sc_iface_index,
 		    sc->sc_xfer + n, sc->sc_config + n, 1,
 		    (void *)(sc->sc_xfer_ctx + n), sc->sc_intr_mtx);
@@ -357,7 +497,9 @@ usbhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
 	rdesc->wrsize = nowrite ? rdesc->srsize :
 	    usbd_xfer_max_len(sc->sc_xfer[USBHID_INTR_OUT_DT]);
 
-	sc->sc_intr_buf = malloc(rdesc->rdsize, M_USBDEV, M_ZERO | M_WAITOK);
+	if (!sc->sc_intr_zerocopy)
+		sc->sc_intr_buf = malloc(rdesc->rdsize * sc->sc_intr_nxfers,
+		    M_USBDEV, M_ZERO | M_WAITOK);
 }
 
 static void
@@ -365,25 +507,56 @@ usbhid_intr_unsetup(device_t dev)
 {
 	struct usbhid_softc* sc = device_get_softc(dev);
 
+	struct hid_request *req;
+
 	usbd_transfer_unsetup(sc->sc_xfer, USBHID_N_TRANSFER);
 	free(sc->sc_intr_buf, M_USBDEV);
+	sc->sc_intr_buf = NULL;
+
+	/* Fail requests left after cancellation of control transfer */
+	mtx_lock(sc->sc_intr_mtx);
+	while ((req = STAILQ_FIRST(&sc->sc_ctrl_q)) != NULL) {
+		STAILQ_REMOVE_HEAD(&sc->sc_ctrl_q, link);
+		req->error = ENXIO;
+		req->actlen = 0;
+		req->cb(req);
+	}
+	sc->sc_xfer_ctx[USBHID_CTRL_DT].influx = false;
+	while ((req = STAILQ_FIRST(&sc->sc_out_q)) != NULL) {
+		STAILQ_REMOVE_HEAD(&sc->sc_out_q, link);
+		req->error = ENXIO;
+		req->actlen = 0;
+		req->cb(req);
+	}
+	sc->sc_xfer_ctx[USBHID_INTR_OUT_DT].influx = false;
+	mtx_unlock(sc->sc_intr_mtx);
 }
 
 static int
 usbhid_intr_start(device_t dev)
 {
 	struct usbhid_softc* sc = device_get_softc(dev);
+	hid_size_t maxlen;
+	int n, x;
 
 	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
 
-	sc->sc_xfer_ctx[USBHID_INTR_IN_DT] = (struct usbhid_xfer_ctx) {
-		.req.intr.maxlen =
-		    usbd_xfer_max_len(sc->sc_xfer[USBHID_INTR_IN_DT]),
-		.cb = usbhid_intr_handler_cb,
-		.cb_ctx = sc,
-		.buf = sc->sc_intr_buf,
-	};
-	usbd_transfer_start(sc->sc_xfer[USBHID_INTR_IN_DT]);
+	maxlen = usbd_xfer_max_len(sc->sc_xfer[USBHID_INTR_IN_DT]);
+	for (n = 0; n < sc->sc_intr_nxfers; n++) {
+		x = USBHID_INTR_IN_XFER(n);
+		if (sc->sc_xfer[x] == NULL)
+			continue;
+		sc->sc_xfer_ctx[x] = (struct usbhid_xfer_ctx) {
+			.req.intr.maxlen = maxlen,
+			.cb = usbhid_intr_handler_cb,
+			.cb_ctx = sc,
+			.buf = sc->sc_intr_zerocopy ?
+			    usbd_xfer_get_frame_buffer(sc->sc_xfer[x], 0) :
+			    (uint8_t *)sc->sc_intr_buf + n * maxlen,
+			.zerocopy = sc->sc_intr_zerocopy,
+		};
+		usbd_transfer_start(sc->sc_xfer[x]);
+	}
 
 	return (0);
 }
@@ -392,10 +565,12 @@ static int
 usbhid_intr_stop(device_t dev)
 {
 	struct usbhid_softc* sc = device_get_softc(dev);
+	int n;
 
 	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
 
-	usbd_transfer_stop(sc->sc_xfer[USBHID_INTR_IN_DT]);
+	for (n = 0; n < sc->sc_intr_nxfers; n++)
+		usbd_transfer_stop(sc->sc_xfer[USBHID_INTR_IN_XFER(n)]);
 	usbd_transfer_stop(sc->sc_xfer[USBHID_INTR_OUT_DT]);
 
 	return (0);
@@ -407,6 +582,9 @@ usbhid_intr_poll(device_t dev)
 	struct usbhid_softc* sc = device_get_softc(dev);
 
 	usbd_transfer_poll(sc->sc_xfer + USBHID_INTR_IN_DT, 1);
+	if (sc->sc_intr_nxfers > 1)
+		usbd_transfer_poll(sc->sc_xfer + USBHID_INTR_IN_DT1,
+		    sc->sc_intr_nxfers - 1);
 }
 
 /*
@@ -434,6 +612,7 @@ usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
 	}
 
 	xfer_ctx->buf = buf;
+	xfer_ctx->zerocopy = false;
 	xfer_ctx->req = *req;
 	xfer_ctx->error = ETIMEDOUT;
 	xfer_ctx->cb = &usbhid_sync_wakeup_cb;
@@ -463,9 +642,20 @@ usbhid_sync_xfer(struct usbhid_softc* sc, int xfer_idx,
 	if (USB_IN_POLLING_MODE_FUNC()) {
 		*xfer_ctx = save;
 	} else {
-		xfer_ctx->influx = false;
-		if (xfer_ctx->waiters != 0)
-			wakeup_one(&xfer_ctx->waiters);
+		/* Resume asynchronous requests queued meanwhile */
+		if (xfer_idx == USBHID_CTRL_DT &&
+		    !STAILQ_EMPTY(&sc->sc_ctrl_q)) {
+			usbhid_ctrl_start(sc);
+			usbd_transfer_start(sc->sc_xfer[xfer_idx]);
+		} else if (xfer_idx == USBHID_INTR_OUT_DT &&
+		    !STAILQ_EMPTY(&sc->sc_out_q)) {
+			usbhid_out_start(sc);
+			usbd_transfer_start(sc->sc_xfer[xfer_idx]);
+		} else {
+			xfer_ctx->influx = false;
+			if (xfer_ctx->waiters != 0)
+				wakeup_one(&xfer_ctx->waiters);
+		}
 		mtx_unlock(sc->sc_intr_mtx);
 	}
 
@@ -490,6 +680,63 @@ usbhid_get_rdesc(device_t dev, void *buf, hid_size_t len)
 	return (error == 0 ? 0 : ENXIO);
 }
 
+static void
+usbhid_init_report_req(struct usbhid_softc *sc, struct usb_device_request *req,
+    bool write, hid_size_t len, uint8_t type, uint8_t id)
+{
+	req->bmRequestType = write ?
+	    UT_WRITE_CLASS_INTERFACE : UT_READ_CLASS_INTERFACE;
+	req->bRequest = write ? UR_SET_REPORT : UR_GET_REPORT;
+	USETW2(req->wValue, type, id);
+	req->wIndex[0] = sc->sc_iface_no;
+	req->wIndex[1] = 0;
+	USETW(req->wLength, len);
+}
+
+/*
+ * Load head of asynchronous request queue in to control transfer context.
+ * Control transfer must be owned by caller.
+ */
+static void
+usbhid_ctrl_start(struct usbhid_softc *sc)
+{
+	struct usbhid_xfer_ctx *xfer_ctx = sc->sc_xfer_ctx + USBHID_CTRL_DT;
+	struct hid_request *req = STAILQ_FIRST(&sc->sc_ctrl_q);
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	usbhid_init_report_req(sc, &xfer_ctx->req.ctrl, req->write, req->len,
+	    req->type, req->id);
+	xfer_ctx->buf = req->data;
+	xfer_ctx->zerocopy = false;
+	xfer_ctx->error = ETIMEDOUT;
+	xfer_ctx->cb = &usbhid_async_cb;
+	xfer_ctx->cb_ctx = sc;
+	xfer_ctx->influx = true;
+}
+
+/*
+ * Load head of asynchronous output report queue in to interrupt OUT transfer
+ * context. Interrupt OUT transfer must be owned by caller. If previous report
+ * is still on the wire, this one is sent right after it is completed.
+ */
+static void
+usbhid_out_start(struct usbhid_softc *sc)
+{
+	struct usbhid_xfer_ctx *xfer_ctx = sc->sc_xfer_ctx + USBHID_INTR_OUT_DT;
+	struct hid_request *req = STAILQ_FIRST(&sc->sc_out_q);
+
+	mtx_assert(sc->sc_intr_mtx, MA_OWNED);
+
+	xfer_ctx->req.intr.maxlen = req->len;
+	xfer_ctx->buf = req->data;
+	xfer_ctx->zerocopy = false;
+	xfer_ctx->error = ETIMEDOUT;
+	xfer_ctx->cb = &usbhid_out_async_cb;
+	xfer_ctx->cb_ctx = sc;
+	xfer_ctx->influx = true;
+}
+
 static int
 usbhid_get_report(device_t dev, void *buf, hid_size_t maxlen,
     hid_size_t *actlen, uint8_t type, uint8_t id)
@@ -501,13 +748,7 @@ usbhid_get_report(device_t dev, void *buf, hid_size_t maxlen,
 	if (maxlen > usbd_xfer_max_len(sc->sc_xfer[USBHID_CTRL_DT]))
 		return (ENOBUFS);
 
-	req.ctrl.bmRequestType = UT_READ_CLASS_INTERFACE;
-	req.ctrl.bRequest = UR_GET_REPORT;
-	USETW2(req.ctrl.wValue, type, id);
-	req.ctrl.wIndex[0] = sc->sc_iface_no;
-	req.ctrl.wIndex[1] = 0;
-	USETW(req.ctrl.wLength, maxlen);
-
+	usbhid_init_report_req(sc, &req.ctrl, false, maxlen, type, id);
 	error = usbhid_sync_xfer(sc, USBHID_CTRL_DT, &req, buf);
 	if (!error && actlen != NULL)
 		*actlen = maxlen;
@@ -525,17 +766,53 @@ usbhid_set_report(device_t dev, const void *buf, hid_size_t len, uint8_t type,
 	if (len > usbd_xfer_max_len(sc->sc_xfer[USBHID_CTRL_DT]))
 		return (ENOBUFS);
 
-	req.ctrl.bmRequestType = UT_WRITE_CLASS_INTERFACE;
-	req.ctrl.bRequest = UR_SET_REPORT;
-	USETW2(req.ctrl.wValue, type, id);
-	req.ctrl.wIndex[0] = sc->sc_iface_no;
-	req.ctrl.wIndex[1] = 0;
-	USETW(req.ctrl.wLength, len);
+	usbhid_init_report_req(sc, &req.ctrl, true, len, type, id);
 
 	return (usbhid_sync_xfer(sc, USBHID_CTRL_DT, &req,
 	    __DECONST(void *, buf)));
 }
 
+static int
+usbhid_submit_report(device_t dev, struct hid_request *req)
+{
+	struct usbhid_softc* sc = device_get_softc(dev);
+	int xfer_idx = req->intr ? USBHID_INTR_OUT_DT : USBHID_CTRL_DT;
+
+	if (req->len > usbd_xfer_max_len(sc->sc_xfer[xfer_idx]))
+		return (ENOBUFS);
+
+	/* Callbacks can not be deferred in polling mode, complete in place */
+	if (USB_IN_POLLING_MODE_FUNC()) {
+		if (req->intr)
+			req->error = usbhid_write(dev, req->data, req->len);
+		else if (req->write)
+			req->error = usbhid_set_report(dev, req->data,
+			    req->len, req->type, req->id);
+		else
+			req->error = usbhid_get_report(dev, req->data,
+			    req->len, &req->actlen, req->type, req->id);
+		req->cb(req);
+		return (0);
+	}
+
+	mtx_lock(sc->sc_intr_mtx);
+	if (req->intr)
+		STAILQ_INSERT_TAIL(&sc->sc_out_q, req, link);
+	else
+		STAILQ_INSERT_TAIL(&sc->sc_ctrl_q, req, link);
+	/* Wait for synchronous or previous requests to finish otherwise */
+	if (!sc->sc_xfer_ctx[xfer_idx].influx) {
+		if (req->intr)
+			usbhid_out_start(sc);
+		else
+			usbhid_ctrl_start(sc);
+		usbd_transfer_start(sc->sc_xfer[xfer_idx]);
+	}
+	mtx_unlock(sc->sc_intr_mtx);
+
+	return (0);
+}
+
 static int
 usbhid_read(device_t dev, void *buf, hid_size_t maxlen, hid_size_t *actlen)
 {
@@ -707,6 +984,7 @@ usbhid_attach(device_t dev)
 {
 	struct usb_attach_arg *uaa = device_get_ivars(dev);
 	struct usbhid_softc *sc = device_get_softc(dev);
+	struct sysctl_oid *tree;
 	device_t child;
 	int error = 0;
 
@@ -717,9 +995,28 @@ usbhid_attach(device_t dev)
 	sc->sc_udev = uaa->device;
 	sc->sc_iface_no = uaa->info.bIfaceNum;
 	sc->sc_iface_index = uaa->info.bIfaceIndex;
+	STAILQ_INIT(&sc->sc_ctrl_q);
+	STAILQ_INIT(&sc->sc_out_q);
 
 	usbhid_fill_device_info(uaa, &sc->sc_hw);
 
+	sc->sc_stat_reports = counter_u64_alloc(M_WAITOK);
+	sc->sc_stat_errors = counter_u64_alloc(M_WAITOK);
+	hid_latency_alloc(sc->sc_stat_latency);
+	tree = SYSCTL_ADD_NODE(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "stats", CTLFLAG_RD, NULL, "statistics");
+	SYSCTL_ADD_COUNTER_U64(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(tree), OID_AUTO, "reports", CTLFLAG_RD,
+	    &sc->sc_stat_reports, "number of input reports delivered");
+	SYSCTL_ADD_COUNTER_U64(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(tree), OID_AUTO, "errors", CTLFLAG_RD,
+	    &sc->sc_stat_errors, "number of interrupt transfer errors");
+	SYSCTL_ADD_COUNTER_U64_ARRAY(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(tree), OID_AUTO, "latency", CTLFLAG_RD,
+	    sc->sc_stat_latency, HID_LATENCY_NBUCKETS,
+	    "input report processing latency, log2(us) histogram");
+
 	error = usbd_req_set_idle(uaa->device, NULL,
 	    uaa->info.bIfaceIndex, 0, 0);
 	if (error) {
@@ -730,6 +1027,7 @@ usbhid_attach(device_t dev)
 	child = device_add_child(dev, "hidbus", -1);
 	if (child == NULL) {
 		device_printf(dev, "Could not add hidbus device\n");
+		usbhid_detach(dev);
 		return (ENOMEM);
 	}
 
@@ -741,12 +1039,29 @@ usbhid_attach(device_t dev)
 	return (0);			/* success */
 }
 
+static int
+usbhid_detach(device_t dev)
+{
+	struct usbhid_softc *sc = device_get_softc(dev);
+	int error;
+
+	error = device_delete_children(dev);
+	if (error != 0)
+		return (error);
+
+	counter_u64_free(sc->sc_stat_reports);
+	counter_u64_free(sc->sc_stat_errors);
+	hid_latency_free(sc->sc_stat_latency);
+
+	return (0);
+}
+
 static devclass_t usbhid_devclass;
 
 static device_method_t usbhid_methods[] = {
 	DEVMETHOD(device_probe,		usbhid_probe),
 	DEVMETHOD(device_attach,	usbhid_attach),
-	DEVMETHOD(device_detach,	device_delete_children),
+	DEVMETHOD(device_detach,	usbhid_detach),
 
 	DEVMETHOD(hid_intr_setup,	usbhid_intr_setup),
 	DEVMETHOD(hid_intr_unsetup,	usbhid_intr_unsetup),
@@ -760,6 +1075,7 @@ static device_method_t usbhid_methods[] = {
 	DEVMETHOD(hid_write,		usbhid_write),
 	DEVMETHOD(hid_get_report,	usbhid_get_report),
 	DEVMETHOD(hid_set_report,	usbhid_set_report),
+	DEVMETHOD(hid_submit_report,	usbhid_submit_report),
 	DEVMETHOD(hid_set_idle,		usbhid_set_idle),
 	DEVMETHOD(hid_set_protocol,	usbhid_set_protocol),
 
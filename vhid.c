@@ -0,0 +1,839 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2020 Vladimir Kondratyev <wulf@FreeBSD.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Virtual HID transport. Attaches hidbus to report descriptor supplied by
+ * userland and replays recorded input report streams through hidbus
+ * interrupt handler. Used to measure per-report cost of HID drivers
+ * without real hardware.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/conf.h>
+#include <sys/counter.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/module.h>
+#include <sys/mutex.h>
+#include <sys/proc.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/uio.h>
+
+#include <dev/evdev/input.h>
+
+#include "hid.h"
+#include "hidraw.h"
+#include "hid_if.h"
+#include "vhid.h"
+
+#define	HID_DEBUG_VAR	vhid_debug
+#include "hid_debug.h"
+
+#ifdef HID_DEBUG
+static int vhid_debug = 0;
+static SYSCTL_NODE(_hw_hid, OID_AUTO, vhid, CTLFLAG_RW, 0,
+    "Virtual HID transport");
+SYSCTL_INT(_hw_hid_vhid, OID_AUTO, debug, CTLFLAG_RWTUN,
+    &vhid_debug, 0, "Debug level");
+#endif
+
+#define	VHID_NREPORTS	256	/* Number of distinct report IDs */
+
+struct vhid_report {
+	hid_size_t		len;
+	uint8_t			data[];
+};
+
+struct vhid_softc {
+	device_t		dev;		/* NULL if not attached */
+	struct sx		sx;		/* Serializes control requests */
+	struct mtx		mtx;		/* Protects feature reports */
+	struct hid_device_info	hw;
+	void			*rdesc;
+	struct vhid_report	*features[VHID_NREPORTS];
+
+	/*
+	 * Transport is driven from control device which is not serialized
+	 * with hidbus detach, so interrupt setup is protected by own lock
+	 * taken before hidbus one.
+	 */
+	struct mtx		intr_lock;
+	struct mtx		*intr_mtx;	/* intr_lock */
+	hid_intr_t		*intr_handler;	/* intr_lock */
+	void			*intr_ctx;	/* intr_lock */
+	uint8_t			*intr_buf;	/* intr_lock */
+	hid_size_t		intr_size;	/* intr_lock */
+	bool			running;	/* intr_mtx */
+
+	counter_u64_t		stat_reports;
+	counter_u64_t		stat_latency[HID_LATENCY_NBUCKETS];
+};
+
+static MALLOC_DEFINE(M_VHID, "vhid", "Virtual HID transport");
+
+static d_write_t	vhid_write_cdev;
+static d_ioctl_t	vhid_ioctl;
+static d_open_t		vhid_open;
+static d_priv_dtor_t	vhid_dtor;
+
+static struct cdevsw vhid_cdevsw = {
+	.d_version =	D_VERSION,
+	.d_open =	vhid_open,
+	.d_write =	vhid_write_cdev,
+	.d_ioctl =	vhid_ioctl,
+	.d_name =	"vhid",
+};
+
+static struct cdev *vhid_cdev;
+
+static device_probe_t	vhid_probe;
+static device_attach_t	vhid_attach;
+static device_detach_t	vhid_detach;
+static device_quiesce_t	vhid_quiesce;
+
+static void
+vhid_intr_setup(device_t dev, struct mtx *mtx, hid_intr_t intr,
+    void *context, struct hid_rdesc_info *rdesc)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	hid_size_t size = MAX(rdesc->isize, 1);
+	uint8_t *buf;
+
+	buf = malloc(size, M_VHID, M_ZERO | M_WAITOK);
+
+	mtx_lock(&sc->intr_lock);
+	mtx_lock(mtx);
+	sc->intr_size = size;
+	sc->intr_buf = buf;
+	sc->intr_handler = intr;
+	sc->intr_ctx = context;
+	sc->intr_mtx = mtx;
+	mtx_unlock(mtx);
+	mtx_unlock(&sc->intr_lock);
+
+	rdesc->rdsize = size;
+	rdesc->wrsize = rdesc->osize;
+	rdesc->grsize = rdesc->fsize;
+	rdesc->srsize = rdesc->fsize;
+}
+
+static void
+vhid_intr_unsetup(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	uint8_t *buf;
+
+	mtx_lock(&sc->intr_lock);
+	mtx_lock(sc->intr_mtx);
+	sc->running = false;
+	sc->intr_handler = NULL;
+	mtx_unlock(sc->intr_mtx);
+	sc->intr_mtx = NULL;
+	buf = sc->intr_buf;
+	sc->intr_buf = NULL;
+	sc->intr_size = 0;
+	mtx_unlock(&sc->intr_lock);
+
+	free(buf, M_VHID);
+}
+
+static int
+vhid_intr_start(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	mtx_assert(sc->intr_mtx, MA_OWNED);
+	sc->running = true;
+
+	return (0);
+}
+
+static int
+vhid_intr_stop(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	mtx_assert(sc->intr_mtx, MA_OWNED);
+	sc->running = false;
+
+	return (0);
+}
+
+static void
+vhid_intr_poll(device_t dev)
+{
+}
+
+static int
+vhid_get_rdesc(device_t dev, void *buf, hid_size_t len)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (len > sc->hw.rdescsize)
+		return (EINVAL);
+
+	memcpy(buf, sc->rdesc, len);
+
+	return (0);
+}
+
+static int
+vhid_read(device_t dev, void *buf, hid_size_t maxlen, hid_size_t *actlen)
+{
+
+	return (EOPNOTSUPP);
+}
+
+/* Output reports are discarded */
+static int
+vhid_write(device_t dev, const void *buf, hid_size_t len)
+{
+
+	return (0);
+}
+
+static int
+vhid_get_report(device_t dev, void *buf, hid_size_t maxlen,
+    hid_size_t *actlen, uint8_t type, uint8_t id)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	struct vhid_report *rep;
+	hid_size_t len = 0;
+
+	memset(buf, 0, maxlen);
+	if (type == HID_FEATURE_REPORT) {
+		mtx_lock(&sc->mtx);
+		rep = sc->features[id];
+		if (rep != NULL) {
+			len = MIN(rep->len, maxlen);
+			memcpy(buf, rep->data, len);
+		}
+		mtx_unlock(&sc->mtx);
+	}
+
+	/* Report not loaded by userland. Return zeroes */
+	if (len == 0 && id != 0 && maxlen > 0)
+		*(uint8_t *)buf = id;
+
+	if (actlen != NULL)
+		*actlen = maxlen;
+
+	return (0);
+}
+
+static int
+vhid_set_report(device_t dev, const void *buf, hid_size_t len, uint8_t type,
+    uint8_t id)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	struct vhid_report *rep, *old = NULL;
+
+	if (type != HID_FEATURE_REPORT)
+		return (0);
+
+	/* Store feature report to be returned by subsequent GET_REPORT */
+	mtx_lock(&sc->mtx);
+	rep = sc->features[id];
+	if (rep == NULL || rep->len < len) {
+		old = rep;
+		rep = malloc(sizeof(*rep) + len, M_VHID, M_NOWAIT);
+		if (rep == NULL) {
+			mtx_unlock(&sc->mtx);
+			return (ENOMEM);
+		}
+		sc->features[id] = rep;
+	}
+	rep->len = len;
+	memcpy(rep->data, buf, len);
+	mtx_unlock(&sc->mtx);
+	free(old, M_VHID);
+
+	return (0);
+}
+
+/* There is no request queue. Complete in place */
+static int
+vhid_submit_report(device_t dev, struct hid_request *req)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+
+	if (req->intr)
+		req->error = vhid_write(dev, req->data, req->len);
+	else if (req->write)
+		req->error = vhid_set_report(dev, req->data, req->len,
+		    req->type, req->id);
+	else
+		req->error = vhid_get_report(dev, req->data, req->len,
+		    &req->actlen, req->type, req->id);
+
+	mtx_lock(&sc->intr_lock);
+	if (sc->intr_mtx == NULL) {
+		mtx_unlock(&sc->intr_lock);
+		return (ENXIO);
+	}
+	mtx_lock(sc->intr_mtx);
+	req->cb(req);
+	mtx_unlock(sc->intr_mtx);
+	mtx_unlock(&sc->intr_lock);
+
+	return (0);
+}
+
+static int
+vhid_set_idle(device_t dev, uint16_t duration, uint8_t id)
+{
+
+	return (0);
+}
+
+static int
+vhid_set_protocol(device_t dev, uint16_t protocol)
+{
+
+	return (0);
+}
+
+/* Longest input report, 0 if hidbus is not attached to the transport */
+static hid_size_t
+vhid_intr_size(struct vhid_softc *sc)
+{
+	hid_size_t size;
+
+	mtx_lock(&sc->intr_lock);
+	size = sc->intr_mtx != NULL ? sc->intr_size : 0;
+	mtx_unlock(&sc->intr_lock);
+
+	return (size);
+}
+
+/*
+ * Pass input report to hidbus the way interrupt handler of real transport
+ * does. Time spent waiting for and holding hidbus lock is accounted.
+ * Returns ENXIO if hidbus is not attached to the transport.
+ */
+static int
+vhid_deliver(struct vhid_softc *sc, const void *data, hid_size_t len,
+    struct vhid_stats *st)
+{
+	sbintime_t start, locked, end;
+	uint64_t hold, wait;
+
+	start = sbinuptime();
+	mtx_lock(&sc->intr_lock);
+	if (sc->intr_mtx == NULL) {
+		mtx_unlock(&sc->intr_lock);
+		return (ENXIO);
+	}
+	if (len > sc->intr_size) {
+		mtx_unlock(&sc->intr_lock);
+		return (EINVAL);
+	}
+	mtx_lock(sc->intr_mtx);
+	if (!sc->running) {
+		mtx_unlock(sc->intr_mtx);
+		mtx_unlock(&sc->intr_lock);
+		if (st != NULL)
+			st->dropped++;
+		return (0);
+	}
+	locked = sbinuptime();
+	/* Copy to transport buffer as handlers expect exclusive one */
+	memcpy(sc->intr_buf, data, len);
+	sc->intr_handler(sc->intr_ctx, sc->intr_buf, len, start);
+	end = sbinuptime();
+	mtx_unlock(sc->intr_mtx);
+	mtx_unlock(&sc->intr_lock);
+
+	counter_u64_add(sc->stat_reports, 1);
+	hid_latency_record(sc->stat_latency, end - locked);
+
+	if (st == NULL)
+		return (0);
+	hold = sbttons(end - locked);
+	wait = sbttons(locked - start);
+	st->reports++;
+	st->hold_ns += hold;
+	st->hold_max_ns = MAX(st->hold_max_ns, hold);
+	st->wait_ns += wait;
+	st->wait_max_ns = MAX(st->wait_max_ns, wait);
+
+	return (0);
+}
+
+static int
+vhid_replay(struct vhid_softc *sc, struct vhid_replay *rp)
+{
+	struct hidraw_report_hdr rh;
+	sbintime_t start, now, next;
+	uint64_t time0 = 0, n = 0;
+	hid_size_t isize;
+	uint8_t *buf;
+	uint32_t off;
+	int error;
+
+	sx_assert(&sc->sx, SA_XLOCKED);
+
+	if (rp->size > VHID_MAX_REPLAY_SIZE)
+		return (EINVAL);
+
+	isize = vhid_intr_size(sc);
+	if (isize == 0)
+		return (ENXIO);
+
+	buf = malloc(rp->size, M_VHID, M_WAITOK);
+	error = copyin(rp->data, buf, rp->size);
+	if (error != 0)
+		goto done;
+
+	/* Validate whole stream up front to keep replay loop short */
+	for (off = 0; off < rp->size; off += sizeof(rh) + rh.rh_len) {
+		if (rp->size - off < sizeof(rh)) {
+			error = EINVAL;
+			goto done;
+		}
+		memcpy(&rh, buf + off, sizeof(rh));
+		if (rh.rh_len > rp->size - off - sizeof(rh) ||
+		    rh.rh_len > isize) {
+			DPRINTF("bad report at offset %u\n", off);
+			error = EINVAL;
+			goto done;
+		}
+		if (off == 0)
+			time0 = rh.rh_time;
+	}
+
+	memset(&rp->stats, 0, sizeof(rp->stats));
+	start = sbinuptime();
+	for (off = 0; off < rp->size; off += sizeof(rh) + rh.rh_len, n++) {
+		memcpy(&rh, buf + off, sizeof(rh));
+
+		if ((rp->flags & VHID_REPLAY_RECORDED) != 0)
+			next = start + nstosbt(rh.rh_time - time0);
+		else if (rp->rate != 0)
+			next = start + n * (SBT_1S / rp->rate);
+		else
+			next = 0;
+		now = sbinuptime();
+		if (next > now) {
+			error = tsleep_sbt(sc, PCATCH, "vhidrp", next, 0,
+			    C_ABSOLUTE);
+			if (error != EWOULDBLOCK) {
+				/* Do not restart replay from the beginning */
+				if (error == ERESTART)
+					error = EINTR;
+				break;
+			}
+			error = 0;
+		} else
+			maybe_yield();
+
+		error = vhid_deliver(sc, buf + off + sizeof(rh), rh.rh_len,
+		    &rp->stats);
+		if (error != 0)
+			break;
+	}
+	rp->stats.elapsed_ns = sbttons(sbinuptime() - start);
+
+	DPRINTF("replayed %ju reports in %ju ns\n",
+	    (uintmax_t)rp->stats.reports, (uintmax_t)rp->stats.elapsed_ns);
+done:
+	free(buf, M_VHID);
+
+	return (error);
+}
+
+static int
+vhid_set_info(struct vhid_softc *sc, struct vhid_info *info)
+{
+	void *rdesc;
+	int error;
+
+	sx_assert(&sc->sx, SA_XLOCKED);
+
+	if (sc->dev != NULL)
+		return (EBUSY);
+	if (info->rdesc_size == 0 ||
+	    info->rdesc_size > VHID_MAX_DESCRIPTOR_SIZE)
+		return (EINVAL);
+
+	rdesc = malloc(info->rdesc_size, M_VHID, M_WAITOK);
+	error = copyin(info->rdesc, rdesc, info->rdesc_size);
+	if (error != 0) {
+		free(rdesc, M_VHID);
+		return (error);
+	}
+
+	free(sc->rdesc, M_VHID);
+	sc->rdesc = rdesc;
+
+	memset(&sc->hw, 0, sizeof(sc->hw));
+	strlcpy(sc->hw.name, info->name, sizeof(sc->hw.name));
+	strlcpy(sc->hw.idPnP, "VHID", sizeof(sc->hw.idPnP));
+	sc->hw.idBus = info->bus != 0 ? info->bus : BUS_VIRTUAL;
+	sc->hw.idVendor = info->vendor;
+	sc->hw.idProduct = info->product;
+	sc->hw.idVersion = info->version;
+	sc->hw.rdescsize = info->rdesc_size;
+
+	return (0);
+}
+
+static int
+vhid_set_feature(struct vhid_softc *sc, struct vhid_feature *feat)
+{
+	struct vhid_report *rep, *old;
+	int error;
+
+	if (feat->id >= VHID_NREPORTS || feat->len > VHID_MAX_DESCRIPTOR_SIZE)
+		return (EINVAL);
+
+	rep = malloc(sizeof(*rep) + feat->len, M_VHID, M_WAITOK);
+	rep->len = feat->len;
+	error = copyin(feat->data, rep->data, feat->len);
+	if (error != 0) {
+		free(rep, M_VHID);
+		return (error);
+	}
+
+	mtx_lock(&sc->mtx);
+	old = sc->features[feat->id];
+	sc->features[feat->id] = rep;
+	mtx_unlock(&sc->mtx);
+	free(old, M_VHID);
+
+	return (0);
+}
+
+static int
+vhid_create(struct vhid_softc *sc)
+{
+	device_t dev;
+	int error;
+
+	sx_assert(&sc->sx, SA_XLOCKED);
+
+	if (sc->dev != NULL)
+		return (EBUSY);
+	if (sc->rdesc == NULL)
+		return (EINVAL);
+
+	mtx_lock(&Giant);
+	dev = device_add_child(root_bus, "vhid", -1);
+	if (dev == NULL) {
+		mtx_unlock(&Giant);
+		return (ENXIO);
+	}
+	device_set_softc(dev, sc);
+	error = device_probe_and_attach(dev);
+	if (error != 0)
+		device_delete_child(root_bus, dev);
+	else
+		sc->dev = dev;
+	mtx_unlock(&Giant);
+
+	return (error);
+}
+
+static int
+vhid_destroy(struct vhid_softc *sc)
+{
+	int error;
+
+	sx_assert(&sc->sx, SA_XLOCKED);
+
+	if (sc->dev == NULL)
+		return (ENXIO);
+
+	mtx_lock(&Giant);
+	error = device_delete_child(root_bus, sc->dev);
+	if (error == 0)
+		sc->dev = NULL;
+	mtx_unlock(&Giant);
+
+	return (error);
+}
+
+static int
+vhid_open(struct cdev *cdev, int fflags, int devtype, struct thread *td)
+{
+	struct vhid_softc *sc;
+	int error;
+
+	sc = malloc(sizeof(*sc), M_VHID, M_ZERO | M_WAITOK);
+	sx_init(&sc->sx, "vhid sx");
+	mtx_init(&sc->mtx, "vhid lock", NULL, MTX_DEF);
+	mtx_init(&sc->intr_lock, "vhid intr lock", NULL, MTX_DEF);
+
+	error = devfs_set_cdevpriv(sc, vhid_dtor);
+	if (error != 0)
+		vhid_dtor(sc);
+
+	return (error);
+}
+
+static void
+vhid_dtor(void *data)
+{
+	struct vhid_softc *sc = data;
+	int i;
+
+	sx_xlock(&sc->sx);
+	if (sc->dev != NULL)
+		(void)vhid_destroy(sc);
+	sx_xunlock(&sc->sx);
+
+	for (i = 0; i < VHID_NREPORTS; i++)
+		free(sc->features[i], M_VHID);
+	free(sc->rdesc, M_VHID);
+	mtx_destroy(&sc->intr_lock);
+	mtx_destroy(&sc->mtx);
+	sx_destroy(&sc->sx);
+	free(sc, M_VHID);
+}
+
+static int
+vhid_write_cdev(struct cdev *cdev, struct uio *uio, int flag)
+{
+	struct vhid_softc *sc;
+	hid_size_t len, isize;
+	uint8_t *buf;
+	int error;
+
+	error = devfs_get_cdevpriv((void **)&sc);
+	if (error != 0)
+		return (error);
+
+	/*
+	 * Each write is a single input report. Size is checked once more on
+	 * delivery as hidbus may go away while the report is copied in.
+	 */
+	isize = vhid_intr_size(sc);
+	if (isize == 0)
+		return (ENXIO);
+	len = uio->uio_resid;
+	if (len == 0 || len > isize)
+		return (EINVAL);
+	buf = malloc(len, M_VHID, M_WAITOK);
+	error = uiomove(buf, len, uio);
+	if (error != 0)
+		goto out;
+
+	sx_xlock(&sc->sx);
+	if (sc->dev == NULL)
+		error = ENXIO;
+	else
+		error = vhid_deliver(sc, buf, len, NULL);
+	sx_xunlock(&sc->sx);
+out:
+	free(buf, M_VHID);
+
+	return (error);
+}
+
+static int
+vhid_ioctl(struct cdev *cdev, u_long cmd, caddr_t addr, int flag,
+    struct thread *td)
+{
+	struct vhid_softc *sc;
+	int error;
+
+	error = devfs_get_cdevpriv((void **)&sc);
+	if (error != 0)
+		return (error);
+
+	sx_xlock(&sc->sx);
+	switch (cmd) {
+	case VHIDIOCSINFO:
+		error = vhid_set_info(sc, (struct vhid_info *)addr);
+		break;
+	case VHIDIOCSFEATURE:
+		error = vhid_set_feature(sc, (struct vhid_feature *)addr);
+		break;
+	case VHIDIOCATTACH:
+		error = vhid_create(sc);
+		break;
+	case VHIDIOCDETACH:
+		error = vhid_destroy(sc);
+		break;
+	case VHIDIOCREPLAY:
+		if (sc->dev == NULL)
+			error = ENXIO;
+		else
+			error = vhid_replay(sc, (struct vhid_replay *)addr);
+		break;
+	default:
+		error = ENOTTY;
+		break;
+	}
+	sx_xunlock(&sc->sx);
+
+	return (error);
+}
+
+static int
+vhid_probe(device_t dev)
+{
+
+	device_set_desc(dev, "Virtual HID transport");
+
+	return (BUS_PROBE_NOWILDCARD);
+}
+
+static int
+vhid_attach(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	struct sysctl_oid *tree;
+	device_t child;
+	int error;
+
+	sc->stat_reports = counter_u64_alloc(M_WAITOK);
+	hid_latency_alloc(sc->stat_latency);
+	tree = SYSCTL_ADD_NODE(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "stats", CTLFLAG_RD, NULL, "statistics");
+	SYSCTL_ADD_COUNTER_U64(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(tree), OID_AUTO, "reports", CTLFLAG_RD,
+	    &sc->stat_reports, "number of input reports delivered");
+	SYSCTL_ADD_COUNTER_U64_ARRAY(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(tree), OID_AUTO, "latency", CTLFLAG_RD,
+	    sc->stat_latency, HID_LATENCY_NBUCKETS,
+	    "input report processing latency, log2(us) histogram");
+
+	child = device_add_child(dev, "hidbus", -1);
+	if (child == NULL) {
+		device_printf(dev, "Could not add hidbus device\n");
+		vhid_detach(dev);
+		return (ENOMEM);
+	}
+
+	device_set_ivars(child, &sc->hw);
+	error = bus_generic_attach(dev);
+	if (error) {
+		device_printf(dev, "failed to attach child: %d\n", error);
+		vhid_detach(dev);
+	}
+
+	return (error);
+}
+
+static int
+vhid_detach(device_t dev)
+{
+	struct vhid_softc *sc = device_get_softc(dev);
+	int error;
+
+	error = device_delete_children(dev);
+	if (error != 0)
+		return (error);
+
+	counter_u64_free(sc->stat_reports);
+	hid_latency_free(sc->stat_latency);
+
+	return (0);
+}
+
+/* Devices go away with control descriptors. Do not let module unload */
+static int
+vhid_quiesce(device_t dev)
+{
+
+	return (EBUSY);
+}
+
+static void
+vhid_init(void *arg)
+{
+	struct make_dev_args mda;
+
+	make_dev_args_init(&mda);
+	mda.mda_flags = MAKEDEV_WAITOK | MAKEDEV_CHECKNAME;
+	mda.mda_devsw = &vhid_cdevsw;
+	mda.mda_uid = UID_ROOT;
+	mda.mda_gid = GID_WHEEL;
+	mda.mda_mode = 0600;
+
+	if (make_dev_s(&mda, &vhid_cdev, "vhidctl") != 0)
+		printf("vhid: Can not create character device\n");
+}
+
+static void
+vhid_uninit(void *arg)
+{
+
+	if (vhid_cdev != NULL)
+		destroy_dev(vhid_cdev);
+}
+
+SYSINIT(vhid_init, SI_SUB_DRIVERS, SI_ORDER_ANY, vhid_init, NULL);
+SYSUNINIT(vhid_uninit, SI_SUB_DRIVERS, SI_ORDER_ANY, vhid_uninit, NULL);
+
+static devclass_t vhid_devclass;
+
+static device_method_t vhid_methods[] = {
+	DEVMETHOD(device_probe,		vhid_probe),
+	DEVMETHOD(device_attach,	vhid_attach),
+	DEVMETHOD(device_detach,	vhid_detach),
+	DEVMETHOD(device_quiesce,	vhid_quiesce),
+
+	DEVMETHOD(hid_intr_setup,	vhid_intr_setup),
+	DEVMETHOD(hid_intr_unsetup,	vhid_intr_unsetup),
+	DEVMETHOD(hid_intr_start,	vhid_intr_start),
+	DEVMETHOD(hid_intr_stop,	vhid_intr_stop),
+	DEVMETHOD(hid_intr_poll,	vhid_intr_poll),
+
+	/* HID interface */
+	DEVMETHOD(hid_get_rdesc,	vhid_get_rdesc),
+	DEVMETHOD(hid_read,		vhid_read),
+	DEVMETHOD(hid_write,		vhid_write),
+	DEVMETHOD(hid_get_report,	vhid_get_report),
+	DEVMETHOD(hid_set_report,	vhid_set_report),
+	DEVMETHOD(hid_submit_report,	vhid_submit_report),
+	DEVMETHOD(hid_set_idle,		vhid_set_idle),
+	DEVMETHOD(hid_set_protocol,	vhid_set_protocol),
+
+	DEVMETHOD_END
+};
+
+static driver_t vhid_driver = {
+	.name = "vhid",
+	.methods = vhid_methods,
+	.size = sizeof(struct vhid_softc),
+};
+
+DRIVER_MODULE(vhid, root, vhid_driver, vhid_devclass, NULL, 0);
+MODULE_DEPEND(vhid, hid, 1, 1, 1);
+MODULE_VERSION(vhid, 1);
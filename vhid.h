@@ -0,0 +1,90 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause-FreeBSD
+ *
+ * Copyright (c) 2020 Vladimir Kondratyev <wulf@FreeBSD.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef _VHID_H
+#define _VHID_H
+
+#include <sys/ioccom.h>
+
+#define	VHID_MAX_DESCRIPTOR_SIZE	4096
+#define	VHID_MAX_REPLAY_SIZE		(16 * 1024 * 1024)
+
+/* Device identity and report descriptor, set before VHIDIOCATTACH */
+struct vhid_info {
+	char		name[80];
+	uint16_t	bus;		/* BUS_* from <dev/evdev/input.h> */
+	uint16_t	vendor;
+	uint16_t	product;
+	uint16_t	version;
+	uint32_t	rdesc_size;
+	const void	*rdesc;
+};
+
+/*
+ * Feature report returned to GET_REPORT requests. Data is the report as
+ * device sends it, i.e. starting with report ID byte if descriptor has them.
+ * HID drivers can overwrite it with SET_REPORT.
+ */
+struct vhid_feature {
+	uint32_t	id;
+	uint32_t	len;
+	const void	*data;
+};
+
+struct vhid_stats {
+	uint64_t	reports;	/* Delivered to hidbus */
+	uint64_t	dropped;	/* Transport was stopped by hidbus */
+	uint64_t	elapsed_ns;	/* Wall time of replay */
+	uint64_t	hold_ns;	/* Time spent in interrupt handler */
+	uint64_t	hold_max_ns;
+	uint64_t	wait_ns;	/* Time spent acquiring hidbus lock */
+	uint64_t	wait_max_ns;
+};
+
+/*
+ * Input report stream in hidraw(4) batch read format: each report is
+ * prepended with struct hidraw_report_hdr. Reports are delivered as fast
+ * as possible, at fixed rate or with recorded rh_time intervals.
+ */
+struct vhid_replay {
+	const void	*data;
+	uint32_t	size;
+	uint32_t	rate;		/* Reports per second, 0 - no limit */
+	uint32_t	flags;
+#define	VHID_REPLAY_RECORDED	0x0001	/* Use recorded timestamps */
+	struct vhid_stats stats;	/* Returned */
+};
+
+#define	VHIDIOCSINFO	_IOW('U', 60, struct vhid_info)
+#define	VHIDIOCSFEATURE	_IOW('U', 61, struct vhid_feature)
+#define	VHIDIOCATTACH	_IO ('U', 62)
+#define	VHIDIOCDETACH	_IO ('U', 63)
+#define	VHIDIOCREPLAY	_IOWR('U', 64, struct vhid_replay)
+
+#endif	/* _VHID_H */
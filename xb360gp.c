@@ -57,7 +57,8 @@ static const uint8_t	xb360gp_rdesc[] = {UHID_XB360GP_REPORT_DESCR()};
 #define XB360GP_MAP_BUT(number, code)	\
 	{ HIDMAP_KEY(HUP_BUTTON, number, code) }
 #define XB360GP_MAP_ABS(usage, code)	\
-	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code) }
+	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
+	    .derive_fuzz = true }
 #define XB360GP_MAP_ABS_FLT(usage, code)	\
 	{ HIDMAP_ABS(HUP_GENERIC_DESKTOP, HUG_##usage, code),	\
 	    .fuzz = 16, .flat = 128 }